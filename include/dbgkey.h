@@ -0,0 +1,52 @@
+/*
+ * The 'debug' parameter of the lesson modules: per-call messages are off by
+ * default and cost a patched-out jump, 'echo 1 > /sys/module/<module>/
+ * parameters/debug' turns them on. The trace events of each module cover
+ * the same points without the console cost; use those for anything high
+ * rate.
+ *
+ * DBG(...)  - DBG_PRINTK(...) while debug is set, printk unless the module
+ *             defines DBG_PRINTK before including this file
+ * dbg_on()  - for messages that need their own printk level
+ *
+ * Defines the parameter, so include it from one file of a module.
+ */
+#ifndef DBGKEY_H
+#define DBGKEY_H
+
+#include <linux/jump_label.h>
+#include <linux/moduleparam.h>
+#include <linux/printk.h>
+
+static DEFINE_STATIC_KEY_FALSE(dbg_key);
+static bool dbg_enabled;
+
+static int dbg_set(const char *val, const struct kernel_param *kp)
+{
+	int err = param_set_bool(val, kp);
+
+	if (err)
+		return err;
+	if (dbg_enabled)
+		static_branch_enable(&dbg_key);
+	else
+		static_branch_disable(&dbg_key);
+	return 0;
+}
+
+static const struct kernel_param_ops dbg_ops = {
+	.set = dbg_set,
+	.get = param_get_bool,
+};
+module_param_cb(debug, &dbg_ops, &dbg_enabled, 0644);
+
+#define dbg_on()	static_branch_unlikely(&dbg_key)
+
+#ifndef DBG_PRINTK
+#define DBG_PRINTK	printk
+#endif
+
+#define DBG(...) \
+	do { if (dbg_on()) DBG_PRINTK(__VA_ARGS__); } while (0)
+
+#endif /* DBGKEY_H */
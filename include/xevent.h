@@ -0,0 +1,141 @@
+/*
+ * Binary event stream of the lesson modules: fixed-size records in per-CPU
+ * relay buffers, read by tools/xevent_drain.
+ *
+ * A module with xevents=1 opens /sys/kernel/debug/xevent_<module>/cpuN and
+ * attaches xevent_emit() to its own trace events, so the hot paths keep
+ * just the tracepoint (a patched-out jump while nothing is attached) and
+ * need no code of their own. Every CPU writes its own buffer with local
+ * interrupts off; no lock is shared. A full buffer drops new records and
+ * counts them in .../dropped instead of overwriting unread ones.
+ *
+ * Records don't straddle sub-buffers, and read()/splice() skip the padding
+ * at the end of each, so a drained file is a plain array of struct xevent.
+ */
+#ifndef XEVENT_H
+#define XEVENT_H
+
+#include <linux/types.h>
+
+enum xevent_type {
+	XEVENT_NONE,
+	XEVENT_XXX_SHOW,	/* arg0: bytes */
+	XEVENT_XXX_STORE,	/* arg0: bytes */
+	XEVENT_XXX_ALLOC,	/* arg0: pointer, arg1: size */
+	XEVENT_XXX_BUFFER,	/* arg0: pointer, arg1: size */
+	XEVENT_XXX_PACK,	/* arg0: bytes, arg1: packed bytes */
+	XEVENT_RW_READ,		/* arg0: length, arg1: not copied */
+	XEVENT_RW_WRITE,	/* arg0: length, arg1: not copied */
+	XEVENT_TM_JIF,		/* arg0: jiffies since the last read, arg1: s */
+	XEVENT_TM_ABSK,		/* arg0: ns since the last read */
+	NR_XEVENT_TYPES
+};
+
+struct xevent {
+	__u64 ts_ns;		/* ktime_get_ns() */
+	__u32 pid;
+	__u16 cpu;
+	__u16 type;		/* enum xevent_type */
+	__u64 arg0;
+	__u64 arg1;
+};
+
+#ifdef __KERNEL__
+#include <linux/relay.h>
+#include <linux/debugfs.h>
+#include <linux/ktime.h>
+#include <linux/sched.h>
+#include <linux/irqflags.h>
+#include <linux/atomic.h>
+
+#define XEVENT_SUBBUFS	8
+
+static struct rchan *xevent_chan;
+static struct dentry *xevent_dir;
+static atomic_t xevent_dropped = ATOMIC_INIT(0);
+
+/* attached to trace events only while the channel is open */
+static void xevent_emit(u16 type, u64 arg0, u64 arg1)
+{
+	struct xevent ev;
+	unsigned long flags;
+
+	ev.pid = current->pid;
+	ev.type = type;
+	ev.arg0 = arg0;
+	ev.arg1 = arg1;
+	local_irq_save(flags);
+	ev.ts_ns = ktime_get_ns();
+	ev.cpu = smp_processor_id();
+	__relay_write(xevent_chan, &ev, sizeof(ev));
+	local_irq_restore(flags);
+}
+
+static struct dentry *xevent_create_buf_file(const char *filename,
+					     struct dentry *parent,
+					     umode_t mode,
+					     struct rchan_buf *buf,
+					     int *is_global)
+{
+	return debugfs_create_file(filename, mode, parent, buf,
+				   &relay_file_operations);
+}
+
+static int xevent_remove_buf_file(struct dentry *dentry)
+{
+	debugfs_remove(dentry);
+	return 0;
+}
+
+/* called on every write that doesn't fit once the buffer is full */
+static int xevent_subbuf_start(struct rchan_buf *buf, void *subbuf,
+			       void *prev_subbuf, size_t prev_padding)
+{
+	if (!relay_buf_full(buf))
+		return 1;
+	atomic_inc(&xevent_dropped);
+	return 0;
+}
+
+static struct rchan_callbacks xevent_callbacks = {
+	.subbuf_start	 = xevent_subbuf_start,
+	.create_buf_file = xevent_create_buf_file,
+	.remove_buf_file = xevent_remove_buf_file,
+};
+
+/* buf_kb per CPU, in XEVENT_SUBBUFS sub-buffers */
+static int xevent_open(const char *name, unsigned int buf_kb)
+{
+	size_t subbuf = max_t(size_t, (size_t)buf_kb * 1024 / XEVENT_SUBBUFS,
+			      PAGE_SIZE);
+
+	xevent_dir = debugfs_create_dir(name, NULL);
+	if (IS_ERR_OR_NULL(xevent_dir)) {
+		int err = xevent_dir ? PTR_ERR(xevent_dir) : -ENOMEM;
+
+		xevent_dir = NULL;
+		return err;
+	}
+	debugfs_create_atomic_t("dropped", 0444, xevent_dir, &xevent_dropped);
+	xevent_chan = relay_open("cpu", xevent_dir, subbuf, XEVENT_SUBBUFS,
+				 &xevent_callbacks, NULL);
+	if (!xevent_chan) {
+		debugfs_remove_recursive(xevent_dir);
+		xevent_dir = NULL;
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+/* after the trace events are detached and tracepoint_synchronize_unregister() */
+static void xevent_close(void)
+{
+	if (xevent_chan)
+		relay_close(xevent_chan);
+	xevent_chan = NULL;
+	debugfs_remove_recursive(xevent_dir);
+	xevent_dir = NULL;
+}
+#endif /* __KERNEL__ */
+
+#endif /* XEVENT_H */
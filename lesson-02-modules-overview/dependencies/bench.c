@@ -0,0 +1,254 @@
+#include <linux/module.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/atomic.h>
+#include <linux/ktime.h>
+#include <linux/slab.h>
+#include <linux/cpumask.h>
+#include <storage.h>
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Aleksandr Bulyshchenko <A.Bulyshchenko@globallogic.com>");
+MODULE_DESCRIPTION("Shared counter and queue benchmark module");
+MODULE_VERSION("0.1");
+
+/*
+ * Every CPU hammers the same counter, for 1, 2, 4, ... threads up to
+ * 'threads' (default: one per online CPU):
+ *   plain  - shared_data++ as importer used to do it (loses updates)
+ *   atomic - atomic_inc() on one shared atomic_t
+ *   percpu - shared_counter_inc() from storage.c
+ *
+ * and the storage_queue throughput with half of the threads producing and
+ * half consuming, 'batch' items per call.
+ */
+
+static unsigned int threads;
+module_param(threads, uint, 0444);
+static unsigned int loops = 1000000;
+module_param(loops, uint, 0444);
+static unsigned int batch = 16;
+module_param(batch, uint, 0444);
+static unsigned int queue_size = 1024;
+module_param(queue_size, uint, 0444);
+
+static atomic_t bench_atomic = ATOMIC_INIT(0);
+
+struct bench;
+
+struct bench_worker {
+	struct bench *bench;
+	unsigned int idx;
+	u64 elapsed_ns;
+};
+
+struct bench {
+	const char *name;
+	void (*run)(struct bench_worker *w);
+	unsigned int nr_threads;
+	struct storage_queue *queue;
+	atomic_long_t consumed;
+	atomic_t ready;
+	atomic_t left;
+	bool go;
+	struct completion done;
+	struct bench_worker *workers;
+};
+
+static void bench_plain(struct bench_worker *w)
+{
+	unsigned int i;
+
+	for (i = 0; i < loops; i++)
+		WRITE_ONCE(shared_data, READ_ONCE(shared_data) + 1);
+}
+
+static void bench_atomic_inc(struct bench_worker *w)
+{
+	unsigned int i;
+
+	for (i = 0; i < loops; i++)
+		atomic_inc(&bench_atomic);
+}
+
+static void bench_percpu(struct bench_worker *w)
+{
+	unsigned int i;
+
+	for (i = 0; i < loops; i++)
+		shared_counter_inc();
+}
+
+/* even workers produce 'loops' items each, odd workers consume */
+static void bench_queue(struct bench_worker *w)
+{
+	struct bench *b = w->bench;
+	long total = (long)((b->nr_threads + 1) / 2) * loops;
+	void *items[64];
+	unsigned int n = min_t(unsigned int, batch ? batch : 1,
+			       ARRAY_SIZE(items));
+	unsigned int i, done = 0, got;
+
+	if (w->idx & 1) {
+		while (atomic_long_read(&b->consumed) < total) {
+			got = storage_queue_pop_batch(b->queue, items, n);
+			if (got)
+				atomic_long_add(got, &b->consumed);
+			else
+				cond_resched();
+		}
+		return;
+	}
+
+	for (i = 0; i < n; i++)
+		items[i] = w;
+	while (done < loops) {
+		got = storage_queue_push_batch(b->queue, items,
+					       min(n, loops - done));
+		if (got)
+			done += got;
+		else
+			cond_resched();
+	}
+}
+
+static int bench_thread(void *data)
+{
+	struct bench_worker *w = data;
+	struct bench *b = w->bench;
+	u64 start;
+
+	atomic_inc(&b->ready);
+	while (!READ_ONCE(b->go))
+		cond_resched();
+
+	start = ktime_get_ns();
+	b->run(w);
+	w->elapsed_ns = ktime_get_ns() - start;
+
+	if (atomic_dec_and_test(&b->left))
+		complete(&b->done);
+	return 0;
+}
+
+/* returns the slowest thread time, 0 on failure */
+static u64 bench_run(struct bench *b)
+{
+	unsigned int i = 0, started = 0, cpu;
+	u64 max_ns = 0;
+
+	atomic_set(&b->ready, 0);
+	atomic_set(&b->left, b->nr_threads);
+	b->go = false;
+	init_completion(&b->done);
+
+	while (started < b->nr_threads) {
+		for_each_online_cpu(cpu) {
+			struct task_struct *t;
+
+			if (started == b->nr_threads)
+				break;
+			b->workers[started].bench = b;
+			b->workers[started].idx = started;
+			b->workers[started].elapsed_ns = 0;
+			t = kthread_create(bench_thread, &b->workers[started],
+					   "dep_bench/%u", cpu);
+			if (IS_ERR(t)) {
+				pr_err("[%s]: can't start thread on cpu %u\n",
+				       THIS_MODULE->name, cpu);
+				/* let already started threads finish */
+				atomic_sub(b->nr_threads - started, &b->left);
+				WRITE_ONCE(b->go, true);
+				if (started)
+					wait_for_completion(&b->done);
+				return 0;
+			}
+			kthread_bind(t, cpu);
+			wake_up_process(t);
+			started++;
+		}
+	}
+
+	while (atomic_read(&b->ready) < b->nr_threads)
+		cond_resched();
+	WRITE_ONCE(b->go, true);
+	wait_for_completion(&b->done);
+
+	for (i = 0; i < b->nr_threads; i++)
+		if (b->workers[i].elapsed_ns > max_ns)
+			max_ns = b->workers[i].elapsed_ns;
+	return max_ns;
+}
+
+static void bench_report(struct bench *b, u64 ops, u64 max_ns, s64 lost)
+{
+	u64 mops_x1000 = max_ns ? div64_u64(ops * 1000000ULL, max_ns) : 0;
+
+	pr_info("[%s]: %-6s %3u threads: %llu.%03llu Mops/s, lost %lld\n",
+		THIS_MODULE->name, b->name, b->nr_threads,
+		mops_x1000 / 1000, mops_x1000 % 1000, lost);
+}
+
+static int __init bench_init(void)
+{
+	struct bench b = { };
+	unsigned int max_threads = threads ? threads : num_online_cpus();
+	unsigned int n;
+
+	b.workers = kcalloc(max_threads, sizeof(*b.workers), GFP_KERNEL);
+	if (!b.workers)
+		return -ENOMEM;
+	b.queue = storage_queue_create(queue_size);
+
+	for (n = 1; ; n = min(n * 2, max_threads)) {
+		u64 ns, ops = (u64)n * loops;
+		u32 plain_start;
+		s64 exact_start;
+
+		b.nr_threads = n;
+
+		b.name = "plain";
+		b.run = bench_plain;
+		plain_start = READ_ONCE(shared_data);
+		ns = bench_run(&b);
+		bench_report(&b, ops, ns, ops -
+			     (u32)(READ_ONCE(shared_data) - plain_start));
+
+		b.name = "atomic";
+		b.run = bench_atomic_inc;
+		atomic_set(&bench_atomic, 0);
+		ns = bench_run(&b);
+		bench_report(&b, ops, ns, ops - atomic_read(&bench_atomic));
+
+		b.name = "percpu";
+		b.run = bench_percpu;
+		exact_start = shared_counter_fold();
+		ns = bench_run(&b);
+		bench_report(&b, ops, ns, ops -
+			     (shared_counter_fold() - exact_start));
+
+		if (n >= 2 && b.queue) {
+			b.name = "queue";
+			b.run = bench_queue;
+			atomic_long_set(&b.consumed, 0);
+			ns = bench_run(&b);
+			ops = (u64)((n + 1) / 2) * loops;
+			bench_report(&b, ops, ns,
+				     ops - atomic_long_read(&b.consumed));
+		}
+
+		if (n == max_threads)
+			break;
+	}
+
+	storage_queue_destroy(b.queue);
+	kfree(b.workers);
+	return 0;
+}
+
+static void __exit bench_exit(void)
+{
+}
+
+module_init(bench_init);
+module_exit(bench_exit);
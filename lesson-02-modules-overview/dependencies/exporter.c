@@ -8,6 +8,10 @@ MODULE_VERSION("0.1");
 
 static int __init exporter_init(void)
 {
+	int err = storage_init();
+
+	if (err)
+		return err;
 	pr_info("[%s]: Hello, I export shared_data (0x%X).\n",
 		THIS_MODULE->name, shared_data);
 	return 0;
@@ -15,8 +19,18 @@ static int __init exporter_init(void)
 
 static void __exit exporter_exit(void)
 {
-	pr_info("[%s]: Goodbye, shared_data was 0x%X.\n",
-		THIS_MODULE->name, shared_data);
+	void *items[16];
+	unsigned int n, drained = 0;
+
+	/* consume whatever importers left in the queue */
+	while ((n = storage_queue_pop_batch(shared_queue, items,
+					    ARRAY_SIZE(items))))
+		drained += n;
+	storage_exit();
+
+	pr_info("[%s]: Drained %u queued items.\n", THIS_MODULE->name, drained);
+	pr_info("[%s]: Goodbye, shared_data was 0x%X, shared_counter was %lld.\n",
+		THIS_MODULE->name, shared_data, shared_counter_fold());
 }
 
 module_init(exporter_init);
@@ -6,18 +6,36 @@ MODULE_AUTHOR("Aleksandr Bulyshchenko <A.Bulyshchenko@globallogic.com>");
 MODULE_DESCRIPTION("Shared variable importer module");
 MODULE_VERSION("0.1");
 
+static unsigned int items = 8;
+module_param(items, uint, 0444);
+
 static int __init importer_init(void)
 {
-	pr_info("[%s]: Hello, I'm importing shared_data (0x%X)\n",
-		THIS_MODULE->name, shared_data);
+	void *batch[16];
+	unsigned int i, n, queued = 0;
+
+	/* produce 'items' work items for the exporter */
+	while (queued < items) {
+		n = min_t(unsigned int, items - queued, ARRAY_SIZE(batch));
+		for (i = 0; i < n; i++)
+			batch[i] = (void *)(unsigned long)(queued + i + 1);
+		n = storage_queue_push_batch(shared_queue, batch, n);
+		if (!n)
+			break;
+		queued += n;
+	}
+	pr_info("[%s]: Queued %u items.\n", THIS_MODULE->name, queued);
+
+	pr_info("[%s]: Hello, I'm importing shared_data (0x%X), shared_counter (%lld)\n",
+		THIS_MODULE->name, shared_data, shared_counter_read_exact());
 	return 0;
 }
 
 static void __exit importer_exit(void)
 {
-	shared_data++;
-	pr_info("[%s]: Goodbye, shared_data is 0x%X now.\n",
-		THIS_MODULE->name, shared_data);
+	shared_counter_inc();
+	pr_info("[%s]: Goodbye, shared_counter is %lld now.\n",
+		THIS_MODULE->name, shared_counter_read_exact());
 }
 
 module_init(importer_init);
@@ -0,0 +1,117 @@
+#include <linux/module.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/string.h>
+#include <keeper.h>
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Aleksandr Bulyshchenko <A.Bulyshchenko@globallogic.com>");
+MODULE_DESCRIPTION("Keeps module state across a reload");
+MODULE_VERSION("0.1");
+
+struct keeper_entry {
+	struct list_head list;
+	char key[KEEPER_KEY_MAX];
+	u32 version;
+	size_t len;
+	void *data;
+};
+
+/* a handful of entries, put and taken once per reload */
+static LIST_HEAD(keeper_list);
+static DEFINE_MUTEX(keeper_lock);
+
+static unsigned int kept;
+module_param(kept, uint, 0444);
+
+static struct keeper_entry *keeper_find(const char *key)
+{
+	struct keeper_entry *e;
+
+	list_for_each_entry(e, &keeper_list, list)
+		if (!strcmp(e->key, key))
+			return e;
+	return NULL;
+}
+
+int keeper_put(const char *key, u32 version, void *data, size_t len)
+{
+	struct keeper_entry *e;
+
+	if (strlen(key) >= KEEPER_KEY_MAX)
+		return -EINVAL;
+
+	mutex_lock(&keeper_lock);
+	e = keeper_find(key);
+	if (e) {
+		kvfree(e->data);
+	} else {
+		e = kzalloc(sizeof(*e), GFP_KERNEL);
+		if (!e) {
+			mutex_unlock(&keeper_lock);
+			return -ENOMEM;
+		}
+		strcpy(e->key, key);
+		list_add(&e->list, &keeper_list);
+		kept++;
+	}
+	e->version = version;
+	e->len = len;
+	e->data = data;
+	mutex_unlock(&keeper_lock);
+
+	pr_info("[%s]: keeping %zu bytes of '%s' v%u\n",
+		THIS_MODULE->name, len, key, version);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(keeper_put);
+
+void *keeper_take(const char *key, u32 version, size_t *len)
+{
+	struct keeper_entry *e;
+	void *data = NULL;
+
+	mutex_lock(&keeper_lock);
+	e = keeper_find(key);
+	if (e) {
+		list_del(&e->list);
+		kept--;
+	}
+	mutex_unlock(&keeper_lock);
+	if (!e)
+		return NULL;
+
+	if (e->version == version) {
+		data = e->data;
+		*len = e->len;
+	} else {
+		pr_warn("[%s]: '%s' is v%u, v%u asked, dropped\n",
+			THIS_MODULE->name, key, e->version, version);
+		kvfree(e->data);
+	}
+	kfree(e);
+	return data;
+}
+EXPORT_SYMBOL_GPL(keeper_take);
+
+static int __init keeper_init(void)
+{
+	return 0;
+}
+
+static void __exit keeper_exit(void)
+{
+	struct keeper_entry *e, *tmp;
+
+	list_for_each_entry_safe(e, tmp, &keeper_list, list) {
+		pr_info("[%s]: dropping '%s' (%zu bytes)\n",
+			THIS_MODULE->name, e->key, e->len);
+		kvfree(e->data);
+		kfree(e);
+	}
+}
+
+module_init(keeper_init);
+module_exit(keeper_exit);
@@ -0,0 +1,21 @@
+#include <linux/types.h>
+
+/*
+ * State keeper: dep_keeper holds blobs for a module that is being reloaded,
+ * so the new instance starts with the old one's data instead of an empty
+ * buffer.
+ *
+ * keeper_put()  - hands 'data' (kmalloc/kvmalloc memory, 'len' bytes) over
+ *                 to the keeper under 'key', replacing what was kept there.
+ *                 On error the caller still owns it.
+ * keeper_take() - hands it back: the caller owns and kvfree()s the result.
+ *                 NULL if nothing is kept under 'key'. A blob stored with
+ *                 another 'version' (layout) is freed instead.
+ *
+ * Nothing is copied either way. Users find the keeper with symbol_get() so
+ * they load and work without it; the symbols are GPL-only for that reason.
+ */
+#define KEEPER_KEY_MAX 32
+
+int keeper_put(const char *key, u32 version, void *data, size_t len);
+void *keeper_take(const char *key, u32 version, size_t *len);
@@ -1,5 +1,242 @@
 #include <linux/export.h>
+#include <linux/percpu.h>
+#include <linux/atomic.h>
+#include <linux/cpu.h>
+#include <linux/smp.h>
+#include <linux/cache.h>
+#include <linux/log2.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/moduleparam.h>
 #include <storage.h>
 
 u32 shared_data = 0xbeaf0000;
 EXPORT_SYMBOL(shared_data);
+
+/*
+ * The counter value is shared_counter_base plus the sum of all per-CPU
+ * deltas. Every transfer subtracts from a delta and adds the same amount to
+ * the base, so the sum stays exact whatever CPU the transfer runs on.
+ */
+static DEFINE_PER_CPU(s64, shared_counter_delta);
+static atomic64_t shared_counter_base = ATOMIC64_INIT(0);
+
+void shared_counter_add(s64 amount)
+{
+	s64 delta = this_cpu_add_return(shared_counter_delta, amount);
+
+	if (unlikely(delta >= SHARED_COUNTER_BATCH ||
+		     delta <= -SHARED_COUNTER_BATCH)) {
+		this_cpu_sub(shared_counter_delta, delta);
+		atomic64_add(delta, &shared_counter_base);
+	}
+}
+EXPORT_SYMBOL(shared_counter_add);
+
+void shared_counter_inc(void)
+{
+	shared_counter_add(1);
+}
+EXPORT_SYMBOL(shared_counter_inc);
+
+s64 shared_counter_read(void)
+{
+	return atomic64_read(&shared_counter_base);
+}
+EXPORT_SYMBOL(shared_counter_read);
+
+s64 shared_counter_read_exact(void)
+{
+	s64 sum = atomic64_read(&shared_counter_base);
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		sum += READ_ONCE(per_cpu(shared_counter_delta, cpu));
+	return sum;
+}
+EXPORT_SYMBOL(shared_counter_read_exact);
+
+/* runs with interrupts disabled, so no local update can interleave */
+static void shared_counter_fold_local(void *unused)
+{
+	s64 delta = __this_cpu_read(shared_counter_delta);
+
+	__this_cpu_sub(shared_counter_delta, delta);
+	atomic64_add(delta, &shared_counter_base);
+}
+
+s64 shared_counter_fold(void)
+{
+	int cpu;
+
+	get_online_cpus();
+	on_each_cpu(shared_counter_fold_local, NULL, 1);
+	for_each_possible_cpu(cpu) {
+		if (cpu_online(cpu))
+			continue;
+		atomic64_add(per_cpu(shared_counter_delta, cpu),
+			     &shared_counter_base);
+		per_cpu(shared_counter_delta, cpu) = 0;
+	}
+	put_online_cpus();
+	return atomic64_read(&shared_counter_base);
+}
+EXPORT_SYMBOL(shared_counter_fold);
+
+
+struct storage_queue_cell {
+	unsigned long seq;
+	void *item;
+};
+
+struct storage_queue {
+	unsigned long head ____cacheline_aligned_in_smp;	/* next pop */
+	unsigned long tail ____cacheline_aligned_in_smp;	/* next push */
+	unsigned long mask ____cacheline_aligned_in_smp;
+	struct storage_queue_cell *cells;
+};
+
+static unsigned int queue_size = 1024;
+module_param(queue_size, uint, 0444);
+
+struct storage_queue *shared_queue;
+EXPORT_SYMBOL(shared_queue);
+
+struct storage_queue *storage_queue_create(unsigned int capacity)
+{
+	struct storage_queue *q;
+	unsigned long i;
+
+	if (capacity < 2)
+		capacity = 2;
+	capacity = roundup_pow_of_two(capacity);
+
+	q = kzalloc(sizeof(*q), GFP_KERNEL);
+	if (!q)
+		return NULL;
+	q->cells = kvmalloc_array(capacity, sizeof(*q->cells), GFP_KERNEL);
+	if (!q->cells) {
+		kfree(q);
+		return NULL;
+	}
+	/* cell i is free for the producer of position i */
+	for (i = 0; i < capacity; i++)
+		q->cells[i].seq = i;
+	q->mask = capacity - 1;
+	return q;
+}
+EXPORT_SYMBOL(storage_queue_create);
+
+void storage_queue_destroy(struct storage_queue *q)
+{
+	if (!q)
+		return;
+	kvfree(q->cells);
+	kfree(q);
+}
+EXPORT_SYMBOL(storage_queue_destroy);
+
+/*
+ * Cell at position pos is free for a producer when seq == pos and holds an
+ * item for a consumer when seq == pos + 1. Only the side that moved
+ * tail/head over a cell may change its seq, so cells seen in the expected
+ * state stay there until the cmpxchg below either claims them or fails.
+ */
+unsigned int storage_queue_push_batch(struct storage_queue *q,
+				      void **items, unsigned int n)
+{
+	struct storage_queue_cell *cell;
+	unsigned long pos, i;
+	long dif = 0;
+
+	if (!n)
+		return 0;
+
+	pos = READ_ONCE(q->tail);
+	for (;;) {
+		for (i = 0; i < n; i++) {
+			cell = &q->cells[(pos + i) & q->mask];
+			dif = (long)(smp_load_acquire(&cell->seq) - (pos + i));
+			if (dif)
+				break;
+		}
+		if (i) {
+			if (cmpxchg(&q->tail, pos, pos + i) == pos)
+				break;
+		} else if (dif < 0) {
+			return 0;	/* full */
+		}
+		pos = READ_ONCE(q->tail);
+	}
+
+	n = i;
+	for (i = 0; i < n; i++) {
+		cell = &q->cells[(pos + i) & q->mask];
+		cell->item = items[i];
+		smp_store_release(&cell->seq, pos + i + 1);
+	}
+	return n;
+}
+EXPORT_SYMBOL(storage_queue_push_batch);
+
+unsigned int storage_queue_pop_batch(struct storage_queue *q,
+				     void **items, unsigned int n)
+{
+	struct storage_queue_cell *cell;
+	unsigned long pos, i;
+	long dif = 0;
+
+	if (!n)
+		return 0;
+
+	pos = READ_ONCE(q->head);
+	for (;;) {
+		for (i = 0; i < n; i++) {
+			cell = &q->cells[(pos + i) & q->mask];
+			dif = (long)(smp_load_acquire(&cell->seq) - (pos + i + 1));
+			if (dif)
+				break;
+		}
+		if (i) {
+			if (cmpxchg(&q->head, pos, pos + i) == pos)
+				break;
+		} else if (dif < 0) {
+			return 0;	/* empty */
+		}
+		pos = READ_ONCE(q->head);
+	}
+
+	n = i;
+	for (i = 0; i < n; i++) {
+		cell = &q->cells[(pos + i) & q->mask];
+		items[i] = cell->item;
+		/* free for the producer of the next lap */
+		smp_store_release(&cell->seq, pos + i + q->mask + 1);
+	}
+	return n;
+}
+EXPORT_SYMBOL(storage_queue_pop_batch);
+
+bool storage_queue_push(struct storage_queue *q, void *item)
+{
+	return storage_queue_push_batch(q, &item, 1);
+}
+EXPORT_SYMBOL(storage_queue_push);
+
+bool storage_queue_pop(struct storage_queue *q, void **item)
+{
+	return storage_queue_pop_batch(q, item, 1);
+}
+EXPORT_SYMBOL(storage_queue_pop);
+
+int storage_init(void)
+{
+	shared_queue = storage_queue_create(queue_size);
+	return shared_queue ? 0 : -ENOMEM;
+}
+
+void storage_exit(void)
+{
+	storage_queue_destroy(shared_queue);
+	shared_queue = NULL;
+}
@@ -1,3 +1,50 @@
 #include <linux/types.h>
 
 extern u32 shared_data;
+
+/*
+ * Scalable counter shared between modules.
+ *
+ * Updates go to a per-CPU delta and only touch the shared cache line once
+ * the delta exceeds SHARED_COUNTER_BATCH, so increments from every CPU do
+ * not bounce a single line around like shared_data++ does.
+ *
+ * shared_counter_read()       - cheap, may lag by up to ~batch * nr_cpus
+ * shared_counter_read_exact() - sums the per-CPU deltas, O(nr_cpus)
+ * shared_counter_fold()       - moves the per-CPU deltas into the shared
+ *                               value (IPI to every CPU) and returns it
+ */
+#define SHARED_COUNTER_BATCH 64
+
+void shared_counter_inc(void);
+void shared_counter_add(s64 amount);
+s64 shared_counter_read(void);
+s64 shared_counter_read_exact(void);
+s64 shared_counter_fold(void);
+
+/*
+ * Bounded lock-free MPMC queue of pointers for passing work items between
+ * modules. Every cell carries a sequence number telling producers and
+ * consumers whose turn it is, so neither side ever takes a lock; head and
+ * tail live on separate cache lines. Batch calls claim several consecutive
+ * cells with a single cmpxchg and may return fewer items than requested
+ * (0 when the queue is full/empty).
+ *
+ * shared_queue is created by dep_exporter (queue_size parameter).
+ */
+struct storage_queue;
+
+extern struct storage_queue *shared_queue;
+
+struct storage_queue *storage_queue_create(unsigned int capacity);
+void storage_queue_destroy(struct storage_queue *q);
+unsigned int storage_queue_push_batch(struct storage_queue *q,
+				      void **items, unsigned int n);
+unsigned int storage_queue_pop_batch(struct storage_queue *q,
+				     void **items, unsigned int n);
+bool storage_queue_push(struct storage_queue *q, void *item);
+bool storage_queue_pop(struct storage_queue *q, void **item);
+
+/* dep_exporter internal */
+int storage_init(void);
+void storage_exit(void);
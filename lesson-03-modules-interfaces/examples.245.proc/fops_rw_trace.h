@@ -0,0 +1,41 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM mod_proc
+
+#if !defined( _FOPS_RW_TRACE_H ) || defined( TRACE_HEADER_MULTI_READ )
+#define _FOPS_RW_TRACE_H
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT( node_read,
+   TP_PROTO( size_t count, loff_t pos ),
+   TP_ARGS( count, pos ),
+   TP_STRUCT__entry(
+      __field( size_t, count )
+      __field( loff_t, pos )
+   ),
+   TP_fast_assign(
+      __entry->count = count;
+      __entry->pos   = pos;
+   ),
+   TP_printk( "%zu bytes (ppos=%lld)", __entry->count, __entry->pos )
+);
+
+TRACE_EVENT( node_write,
+   TP_PROTO( size_t count ),
+   TP_ARGS( count ),
+   TP_STRUCT__entry(
+      __field( size_t, count )
+   ),
+   TP_fast_assign(
+      __entry->count = count;
+   ),
+   TP_printk( "%zu bytes", __entry->count )
+);
+
+#endif /* _FOPS_RW_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE fops_rw_trace
+#include <trace/define_trace.h>
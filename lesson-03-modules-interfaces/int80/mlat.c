@@ -0,0 +1,384 @@
+#include <linux/module.h>
+#include <linux/kprobes.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/percpu.h>
+#include <linux/ktime.h>
+#include <linux/sched.h>
+#include <linux/compat.h>
+#include <linux/log2.h>
+#include <linux/math64.h>
+#include <linux/version.h>
+#include <linux/rcupdate.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Latency of the syscalls issued by the int80 examples");
+
+/*
+ * Time spent in the sys_* handlers of write, mknod and getpid, from entry
+ * to return of the handler (kretprobes), so the entry code and the way back
+ * to user space are not included. Histograms are kept per syscall and per
+ * entry path, "compat" for 32-bit calls (int 0x80 of mp, or sysenter of
+ * mpsys/mplib through the vDSO) and "64" for native ones, in per-CPU
+ * counters that are only summed when read:
+ *
+ *   /sys/kernel/debug/mlat/hist   - count, average, maximum, log2 buckets
+ *   /sys/kernel/debug/mlat/reset  - write anything to clear the counters
+ *
+ * 'pid' (thread group id) and 'comm' restrict tracing to one process or
+ * program name, both can be changed at run time. A call still running when
+ * the filter changes is reported by what matched at its entry.
+ */
+
+static int pid;
+module_param(pid, int, 0644);
+
+/*
+ * The probes read the name under RCU while a store replaces it, so they
+ * see the old name or the new one, never a mix. No name is no filter.
+ */
+struct mlat_comm {
+	struct rcu_head rcu;
+	char name[TASK_COMM_LEN];
+};
+
+static struct mlat_comm __rcu *mlat_comm;
+
+/* stores are serialized by the parameter lock */
+static void comm_publish(struct mlat_comm *c)
+{
+	struct mlat_comm *old = rcu_dereference_protected(mlat_comm, 1);
+
+	rcu_assign_pointer(mlat_comm, c);
+	if (old)
+		kfree_rcu(old, rcu);
+}
+
+/* 'echo mp > .../comm' brings a newline, which no task name has */
+static int comm_set(const char *val, const struct kernel_param *kp)
+{
+	struct mlat_comm *c = NULL;
+	char *dup, *name;
+	int err = 0;
+
+	dup = kstrdup(val, GFP_KERNEL);
+	if (!dup)
+		return -ENOMEM;
+	name = strim(dup);
+	if (strlen(name) >= TASK_COMM_LEN) {
+		err = -ENOSPC;
+		goto out;
+	}
+	if (*name) {
+		c = kzalloc(sizeof(*c), GFP_KERNEL);
+		if (!c) {
+			err = -ENOMEM;
+			goto out;
+		}
+		strscpy(c->name, name, sizeof(c->name));
+	}
+	comm_publish(c);
+out:
+	kfree(dup);
+	return err;
+}
+
+static int comm_get(char *buffer, const struct kernel_param *kp)
+{
+	struct mlat_comm *c;
+	int len;
+
+	rcu_read_lock();
+	c = rcu_dereference(mlat_comm);
+	len = scnprintf(buffer, PAGE_SIZE, "%s\n", c ? c->name : "");
+	rcu_read_unlock();
+	return len;
+}
+
+static const struct kernel_param_ops comm_ops = {
+	.set = comm_set,
+	.get = comm_get,
+};
+module_param_cb(comm, &comm_ops, NULL, 0644);
+
+#define MLAT_BUCKETS	32	/* bucket b: [2^b, 2^(b+1)) ns, the last one open */
+
+enum { SYS_WRITE, SYS_MKNOD, SYS_GETPID, NR_SYS };
+enum { PATH_64, PATH_COMPAT, NR_PATHS };
+
+static const char * const sys_names[NR_SYS] = { "write", "mknod", "getpid" };
+static const char * const path_names[NR_PATHS] = { "64", "compat" };
+
+/*
+ * Since 4.17 x86-64 calls sys_* through per-ABI wrappers, and a 32-bit
+ * call never reaches __x64_sys_*. The path is still taken from
+ * in_compat_syscall(), which works with either layout.
+ */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 17, 0) && defined(CONFIG_X86_64)
+#define SYS_SYMS(name)	{ "__x64_sys_" #name, "__ia32_sys_" #name }
+#else
+#define SYS_SYMS(name)	{ "sys_" #name }
+#endif
+#define SYMS_PER_SYS	2
+
+static const char * const sys_syms[NR_SYS][SYMS_PER_SYS] = {
+	[SYS_WRITE]	= SYS_SYMS(write),
+	[SYS_MKNOD]	= SYS_SYMS(mknod),
+	[SYS_GETPID]	= SYS_SYMS(getpid),
+};
+
+struct mlat_hist {
+	u64 count;
+	u64 sum_ns;
+	u64 max_ns;
+	u64 buckets[MLAT_BUCKETS];
+};
+
+/* written only by the return handlers of this CPU, with preemption off */
+struct mlat_cpu {
+	struct mlat_hist hist[NR_SYS][NR_PATHS];
+};
+
+static DEFINE_PER_CPU(struct mlat_cpu, mlat_cpu);
+
+struct mlat_probe {
+	struct kretprobe krp;
+	unsigned int sys;
+	bool registered;
+};
+
+static struct mlat_probe probes[NR_SYS * SYMS_PER_SYS];
+
+/* kretprobe_instance private data, from entry to return */
+struct mlat_data {
+	u64 start;
+	unsigned int path;
+};
+
+static struct dentry *mlat_dir;
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 11, 0)
+#define get_kretprobe(ri)	((ri)->rp)
+#endif
+
+static bool mlat_match(void)
+{
+	int want = READ_ONCE(pid);
+	struct mlat_comm *c;
+	bool match = true;
+
+	if (want && task_tgid_nr(current) != want)
+		return false;
+	rcu_read_lock();
+	c = rcu_dereference(mlat_comm);
+	if (c && strncmp(current->comm, c->name, TASK_COMM_LEN))
+		match = false;
+	rcu_read_unlock();
+	return match;
+}
+
+/* a non-zero return skips the return handler of this call */
+static int mlat_entry(struct kretprobe_instance *ri, struct pt_regs *regs)
+{
+	struct mlat_data *d = (struct mlat_data *)ri->data;
+
+	if (!mlat_match())
+		return 1;
+	d->path = in_compat_syscall() ? PATH_COMPAT : PATH_64;
+	d->start = ktime_get_ns();
+	return 0;
+}
+
+static int mlat_return(struct kretprobe_instance *ri, struct pt_regs *regs)
+{
+	struct mlat_data *d = (struct mlat_data *)ri->data;
+	struct mlat_probe *p = container_of(get_kretprobe(ri),
+					    struct mlat_probe, krp);
+	u64 ns = ktime_get_ns() - d->start;
+	struct mlat_hist *h = &this_cpu_ptr(&mlat_cpu)->hist[p->sys][d->path];
+
+	h->count++;
+	h->sum_ns += ns;
+	if (ns > h->max_ns)
+		h->max_ns = ns;
+	h->buckets[ns ? min_t(unsigned int, ilog2(ns), MLAT_BUCKETS - 1) : 0]++;
+	return 0;
+}
+
+static void mlat_fold(unsigned int sys, unsigned int path, struct mlat_hist *sum)
+{
+	unsigned int cpu, b;
+
+	memset(sum, 0, sizeof(*sum));
+	for_each_possible_cpu(cpu) {
+		struct mlat_hist *h = &per_cpu_ptr(&mlat_cpu, cpu)->hist[sys][path];
+
+		sum->count += READ_ONCE(h->count);
+		sum->sum_ns += READ_ONCE(h->sum_ns);
+		sum->max_ns = max(sum->max_ns, READ_ONCE(h->max_ns));
+		for (b = 0; b < MLAT_BUCKETS; b++)
+			sum->buckets[b] += READ_ONCE(h->buckets[b]);
+	}
+}
+
+static int hist_show(struct seq_file *m, void *v)
+{
+	struct mlat_hist sum;
+	unsigned int sys, path, b, i;
+	struct mlat_comm *c;
+
+	rcu_read_lock();
+	c = rcu_dereference(mlat_comm);
+	seq_printf(m, "pid %d comm '%s'\n", READ_ONCE(pid), c ? c->name : "");
+	rcu_read_unlock();
+	for (sys = 0; sys < NR_SYS; sys++) {
+		for (path = 0; path < NR_PATHS; path++) {
+			mlat_fold(sys, path, &sum);
+			seq_printf(m, "%s %s: count %llu avg %llu ns max %llu ns\n",
+				   sys_names[sys], path_names[path], sum.count,
+				   sum.count ? div64_u64(sum.sum_ns, sum.count) : 0,
+				   sum.max_ns);
+			for (b = 0; b < MLAT_BUCKETS; b++) {
+				if (!sum.buckets[b])
+					continue;
+				seq_printf(m, "  %12llu ns%s %12llu\n",
+					   b ? 1ULL << b : 0ULL,
+					   b == MLAT_BUCKETS - 1 ? "+" : " ",
+					   sum.buckets[b]);
+			}
+		}
+	}
+	for (i = 0; i < ARRAY_SIZE(probes); i++)
+		if (probes[i].registered)
+			seq_printf(m, "%s: missed %d\n",
+				   probes[i].krp.kp.symbol_name,
+				   probes[i].krp.nmissed);
+	return 0;
+}
+
+static int hist_open(struct inode *inode, struct file *file_p)
+{
+	return single_open(file_p, hist_show, NULL);
+}
+
+static const struct file_operations hist_fops = {
+	.owner   = THIS_MODULE,
+	.open    = hist_open,
+	.read    = seq_read,
+	.llseek  = seq_lseek,
+	.release = single_release,
+};
+
+/* calls returning while this runs may be kept or lost */
+static ssize_t reset_write(struct file *file_p, const char __user *buffer,
+			   size_t length, loff_t *offset)
+{
+	unsigned int cpu;
+
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(&mlat_cpu, cpu), 0, sizeof(struct mlat_cpu));
+	return length;
+}
+
+static const struct file_operations reset_fops = {
+	.owner   = THIS_MODULE,
+	.write   = reset_write,
+};
+
+static void mlat_unregister(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(probes); i++) {
+		if (!probes[i].registered)
+			continue;
+		unregister_kretprobe(&probes[i].krp);
+		probes[i].registered = false;
+	}
+}
+
+/*
+ * SYSCALL_DEFINE0 can make __ia32_sys_getpid an alias of __x64_sys_getpid
+ * (4.17 to 5.6): both probes would sit on one address and count each call
+ * twice, so a probe on an address already probed goes again. Calls
+ * made in the moment both were there may count twice.
+ */
+static bool mlat_probed(const struct mlat_probe *p)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(probes); i++)
+		if (&probes[i] != p && probes[i].registered &&
+		    probes[i].krp.kp.addr == p->krp.kp.addr)
+			return true;
+	return false;
+}
+
+/* a missing entry point (no IA32 emulation, say) is skipped, not fatal */
+static int mlat_register(void)
+{
+	unsigned int sys, s, n = 0;
+	int err;
+
+	for (sys = 0; sys < NR_SYS; sys++) {
+		for (s = 0; s < SYMS_PER_SYS; s++) {
+			struct mlat_probe *p = &probes[sys * SYMS_PER_SYS + s];
+
+			if (sys_syms[sys][s] == NULL)
+				continue;
+			p->sys = sys;
+			p->krp.kp.symbol_name = sys_syms[sys][s];
+			p->krp.entry_handler = mlat_entry;
+			p->krp.handler = mlat_return;
+			p->krp.data_size = sizeof(struct mlat_data);
+			err = register_kretprobe(&p->krp);
+			if (err) {
+				pr_warn("[%s]: %s not probed: %d\n",
+					THIS_MODULE->name, sys_syms[sys][s], err);
+				continue;
+			}
+			if (mlat_probed(p)) {
+				unregister_kretprobe(&p->krp);
+				pr_info("[%s]: %s is an alias, probed once\n",
+					THIS_MODULE->name, sys_syms[sys][s]);
+				continue;
+			}
+			p->registered = true;
+			n++;
+		}
+	}
+	return n ? 0 : -ENOENT;
+}
+
+static int __init mlat_init(void)
+{
+	int err;
+
+	mlat_dir = debugfs_create_dir("mlat", NULL);
+	if (IS_ERR_OR_NULL(mlat_dir)) {
+		comm_publish(NULL);
+		return mlat_dir ? PTR_ERR(mlat_dir) : -ENOMEM;
+	}
+	debugfs_create_file("hist", 0444, mlat_dir, NULL, &hist_fops);
+	debugfs_create_file("reset", 0200, mlat_dir, NULL, &reset_fops);
+
+	err = mlat_register();
+	if (err) {
+		debugfs_remove_recursive(mlat_dir);
+		comm_publish(NULL);
+		return err;
+	}
+	return 0;
+}
+
+static void __exit mlat_exit(void)
+{
+	debugfs_remove_recursive(mlat_dir);
+	mlat_unregister();
+	comm_publish(NULL);
+}
+
+module_init(mlat_init);
+module_exit(mlat_exit);
@@ -5,6 +5,30 @@
 #include <linux/sched.h>
 #include <linux/uaccess.h>
 #include <linux/slab.h>
+#include <linux/moduleparam.h>
+#include <linux/mutex.h>
+#include <linux/mm.h>
+#include <linux/highmem.h>
+#include <linux/version.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/seq_file.h>
+#include <linux/rhashtable.h>
+#include <linux/list.h>
+#include <linux/percpu.h>
+#include <linux/workqueue.h>
+#include <linux/ktime.h>
+#include <linux/atomic.h>
+#include <linux/ctype.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 11, 0)
+#include <linux/sched/signal.h>
+#endif
+
+#define CREATE_TRACE_POINTS
+#include "rw_trace.h"
+#include "rw_ioctl.h"
+#include <xevent.h>
 
 MODULE_LICENSE("Dual BSD/GPL");
 MODULE_AUTHOR("Aleksandr Bulyshchenko <A.Bulyshchenko@globallogic.com>");
@@ -15,123 +39,562 @@ MODULE_VERSION("0.1");
 #define MODULE_TAG		"example_module "
 #define PROC_DIRECTORY	"example"
 #define PROC_FILENAME	"buffer"
-#define BUFFER_SIZE		10
+#define PROC_CONTROL	"control"
 
 
-static char *proc_buffer;
-static size_t proc_msg_length;
-static size_t proc_msg_read_pos;
+#include <dbgkey.h>
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 6, 0)
+/* no FOLL_PIN yet: plain page references do the same job here */
+#define pin_user_pages_fast(start, nr_pages, gup_flags, pages) \
+	get_user_pages_fast(start, nr_pages, 0, pages)
+
+static void unpin_user_pages(struct page **pages, unsigned long npages)
+{
+	while (npages--)
+		put_page(pages[npages]);
+}
+#endif
+
+#include "rw_buf.c"
+
+/* see rw_buf.c */
+module_param(zerocopy_min, ulong, 0644);
+module_param(pin_budget, uint, 0644);
+module_param(zerocopy_writes, ulong, 0444);
+module_param(zerocopy_fallbacks, ulong, 0444);
+module_param(log_mode, bool, 0444);
+module_param(log_size, uint, 0444);
+module_param(log_overruns, ulong, 0444);
+module_param(defer_ms, uint, 0444);
+module_param(defer_writes, ulong, 0444);
+module_param(defer_flushes, ulong, 0444);
+module_param(defer_coalesced, ulong, 0444);
+module_param(defer_lag_max_us, ulong, 0444);
+module_param(defer_lag_last_us, ulong, 0444);
+
+
+/*
+ * xevents=1: the trace events also go to the relay channel of <xevent.h>,
+ * /sys/kernel/debug/xevent_procfs_rw/cpuN, xevent_buf_kb per CPU.
+ */
+static bool xevents;
+module_param(xevents, bool, 0444);
+static unsigned int xevent_buf_kb = 256;
+module_param(xevent_buf_kb, uint, 0444);
+
+static void xev_read(void *data, size_t length, size_t left)
+{
+	xevent_emit(XEVENT_RW_READ, length, left);
+}
+
+static void xev_write(void *data, size_t length, size_t left)
+{
+	xevent_emit(XEVENT_RW_WRITE, length, left);
+}
+
+/* probes xevents_start() registered, the only ones to unregister */
+static unsigned int xev_probes;
+
+static void xevents_stop(void)
+{
+	if (!xevent_chan)
+		return;
+	if (xev_probes > 1)
+		unregister_trace_example_write(xev_write, NULL);
+	if (xev_probes > 0)
+		unregister_trace_example_read(xev_read, NULL);
+	xev_probes = 0;
+	tracepoint_synchronize_unregister();
+	xevent_close();
+}
+
+/* failing here costs the events, not the module */
+static void xevents_start(void)
+{
+	int err;
+
+	if (!xevents)
+		return;
+	err = xevent_open("xevent_" KBUILD_MODNAME, xevent_buf_kb);
+	if (!err && !(err = register_trace_example_read(xev_read, NULL)))
+		xev_probes++;
+	if (!err && !(err = register_trace_example_write(xev_write, NULL)))
+		xev_probes++;
+	if (err) {
+		pr_warn(MODULE_TAG "no event channel: %d\n", err);
+		xevents_stop();
+	}
+}
+
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 17, 0)
+#define PDE_DATA(inode)	pde_data(inode)
+#endif
+
 
 static struct proc_dir_entry *proc_dir;
 static struct proc_dir_entry *proc_file;
+static struct proc_dir_entry *proc_control;
+
+
+static int example_open(struct inode *inode, struct file *file_p)
+{
+	struct example_file *f = kzalloc(sizeof(*f), GFP_KERNEL);
+
+	if (f == NULL)
+		return -ENOMEM;
+	f->buf = PDE_DATA(inode);
+	file_p->private_data = f;
+	return 0;
+}
+
+
+static int example_release(struct inode *inode, struct file *file_p)
+{
+	kfree(file_p->private_data);
+	return 0;
+}
+
+
+/*
+ * Busy-poll reads (RW_IOC_BUSY_POLL): a reader waiting for the next write
+ * spins on write_seq instead of going to sleep at once, so a writer on
+ * another CPU hands over a message without a wakeup. The spin adapts per
+ * file: a hit doubles it up to the budget, a fallback to sleeping halves
+ * it down to a sixteenth, so a reader whose writer has gone quiet stops
+ * burning its CPU. busy_spin_hits and busy_fallbacks count both outcomes.
+ */
+static atomic_long_t busy_spin_hits;
+static atomic_long_t busy_fallbacks;
+
+static int busy_stat_get(char *buffer, const struct kernel_param *kp)
+{
+	return sprintf(buffer, "%ld\n", atomic_long_read(kp->arg));
+}
+
+static const struct kernel_param_ops busy_stat_ops = {
+	.get = busy_stat_get,
+};
+module_param_cb(busy_spin_hits, &busy_stat_ops, &busy_spin_hits, 0444);
+module_param_cb(busy_fallbacks, &busy_stat_ops, &busy_fallbacks, 0444);
+
+
+/* waits for a write after 'seq' was seen, 0 or -ERESTARTSYS */
+static int example_busy_wait(struct example_file *f, unsigned long seq)
+{
+	struct example_buf *b = f->buf;
+	u64 start = ktime_get_ns();
+
+	do {
+		if (READ_ONCE(b->write_seq) != seq) {
+			atomic_long_inc(&busy_spin_hits);
+			f->spin_ns = min(f->spin_ns * 2, f->busy_ns);
+			return 0;
+		}
+		cpu_relax();
+	} while (ktime_get_ns() - start < f->spin_ns && !need_resched() &&
+		 !signal_pending(current));
+
+	atomic_long_inc(&busy_fallbacks);
+	f->spin_ns = max(f->spin_ns / 2, f->busy_ns / 16);
+	if (wait_event_interruptible(b->wait, READ_ONCE(b->write_seq) != seq))
+		return -ERESTARTSYS;
+	return 0;
+}
+
+
+static ssize_t example_file_read(struct file *file_p, char __user *buffer,
+				 size_t length, loff_t *offset)
+{
+	struct example_file *f = file_p->private_data;
+	struct example_buf *b = f->buf;
+	unsigned long seq;
+	int res;
+
+	for (;;) {
+		/* before the read, so a write in between ends the wait */
+		seq = READ_ONCE(b->write_seq);
+		res = example_read(file_p, buffer, length, offset);
+		if (res || !length || !f->busy_ns || READ_ONCE(b->closing))
+			return res;
+		if (file_p->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		res = example_busy_wait(f, seq);
+		if (res)
+			return res;
+	}
+}
+
+
+static long example_ioctl(struct file *file_p, unsigned int cmd,
+			  unsigned long arg)
+{
+	struct example_file *f = file_p->private_data;
+	u32 ns;
+
+	if (cmd != RW_IOC_BUSY_POLL)
+		return -ENOTTY;
+	if (get_user(ns, (u32 __user *)arg))
+		return -EFAULT;
+	if (ns > RW_BUSY_POLL_MAX_NS)
+		return -EINVAL;
+	f->busy_ns = ns;
+	f->spin_ns = ns;
+	return 0;
+}
+
+
+/* lets busy-poll readers go before the entry is removed, which waits for them */
+static void example_buf_close(struct example_buf *b)
+{
+	mutex_lock(&b->lock);
+	b->closing = true;
+	example_buf_written(b);
+	mutex_unlock(&b->lock);
+	wake_up_interruptible_all(&b->wait);
+}
 
-static int example_read(struct file *file_p, char __user *buffer,
-						size_t length, loff_t *offset);
-static int example_write(struct file *file_p, const char __user *buffer,
-						 size_t length, loff_t *offset);
 
 static const struct file_operations proc_fops = {
-	.read  = example_read,
-	.write = example_write,
+	.open           = example_open,
+	.release        = example_release,
+	.read           = example_file_read,
+	.write          = example_write,
+	.unlocked_ioctl = example_ioctl,
+	.compat_ioctl   = example_ioctl,
 };
 
 
-static int create_buffer(void)
+/*
+ * Instances: "add NAME" written to /proc/example/control creates
+ * /proc/example/NAME with a buffer of its own, "del NAME" removes it and
+ * reading control lists them with their counters.
+ *
+ * The instances are hashed by name for add/del, and an open file reaches
+ * its instance through the proc entry data, so neither lookup nor I/O
+ * walks the others. All of them are also on inst_list to be freed at
+ * unload without a table walk.
+ */
+#define INST_NAME_MAX	32
+
+struct example_inst {
+	struct rhash_head node;
+	struct list_head list;
+	struct proc_dir_entry *entry;
+	char name[INST_NAME_MAX];	/* zero padded, the hash key */
+	struct example_buf buf;
+};
+
+static const struct rhashtable_params inst_params = {
+	.key_len	     = INST_NAME_MAX,
+	.key_offset	     = offsetof(struct example_inst, name),
+	.head_offset	     = offsetof(struct example_inst, node),
+	.automatic_shrinking = true,
+};
+
+static struct rhashtable inst_table;
+static bool inst_table_ready;
+static struct kmem_cache *inst_cache;
+static LIST_HEAD(inst_list);
+static unsigned int inst_count;
+/* serializes add/del, the buffers have their own locks */
+static DEFINE_MUTEX(inst_lock);
+
+
+static int inst_add(const char *key)
 {
-	proc_buffer = kmalloc(BUFFER_SIZE, GFP_KERNEL);
-	if (proc_buffer == NULL)
+	struct example_inst *inst;
+	int err;
+
+	inst = kmem_cache_zalloc(inst_cache, GFP_KERNEL);
+	if (inst == NULL)
 		return -ENOMEM;
-	proc_msg_length = 0;
+	memcpy(inst->name, key, INST_NAME_MAX);
+	example_buf_init(&inst->buf);
 
+	mutex_lock(&inst_lock);
+	err = rhashtable_lookup_insert_fast(&inst_table, &inst->node,
+					    inst_params);
+	if (err)
+		goto error;
+
+	inst->entry = proc_create_data(inst->name, S_IFREG | S_IRUGO | S_IWUGO,
+				       proc_dir, &proc_fops, &inst->buf);
+	if (inst->entry == NULL) {
+		rhashtable_remove_fast(&inst_table, &inst->node, inst_params);
+		err = -ENOMEM;
+		goto error;
+	}
+	list_add(&inst->list, &inst_list);
+	inst_count++;
+	mutex_unlock(&inst_lock);
 	return 0;
+
+error:
+	mutex_unlock(&inst_lock);
+	kmem_cache_free(inst_cache, inst);
+	return err;
+}
+
+
+/* inst_lock held or the module going away, proc_remove() waits for readers */
+static void inst_free(struct example_inst *inst)
+{
+	example_buf_close(&inst->buf);
+	proc_remove(inst->entry);
+	list_del(&inst->list);
+	inst_count--;
+	example_buf_cleanup(&inst->buf);
+	kmem_cache_free(inst_cache, inst);
 }
 
 
-static void cleanup_buffer(void)
+static int inst_del(const char *key)
 {
-	if (proc_buffer) {
-		kfree(proc_buffer);
-		proc_buffer = NULL;
+	struct example_inst *inst;
+
+	mutex_lock(&inst_lock);
+	inst = rhashtable_lookup_fast(&inst_table, key, inst_params);
+	if (inst == NULL) {
+		mutex_unlock(&inst_lock);
+		return -ENOENT;
 	}
-	proc_msg_length = 0;
+	rhashtable_remove_fast(&inst_table, &inst->node, inst_params);
+	inst_free(inst);
+	mutex_unlock(&inst_lock);
+	return 0;
 }
 
 
-static int create_proc_example(void)
+static int control_show(struct seq_file *m, void *v)
 {
-	proc_dir = proc_mkdir(PROC_DIRECTORY, NULL);
-	if (proc_dir == NULL)
-		return -EFAULT;
+	struct example_inst *inst;
+
+	mutex_lock(&inst_lock);
+	seq_printf(m, "instances: %u\n", inst_count);
+	list_for_each_entry(inst, &inst_list, list) {
+		struct example_buf *b = &inst->buf;
+
+		mutex_lock(&b->lock);
+		seq_printf(m, "%s: length %zu, reads %lu (%lu bytes), writes %lu (%lu bytes)\n",
+			   inst->name, b->msg_length, b->reads, b->read_bytes,
+			   b->writes, b->written_bytes);
+		mutex_unlock(&b->lock);
+	}
+	mutex_unlock(&inst_lock);
+	return 0;
+}
 
-	proc_file = proc_create(PROC_FILENAME, S_IFREG | S_IRUGO | S_IWUGO,
-							proc_dir, &proc_fops);
-	if (proc_file == NULL)
+
+/* a name proc can take: printable, no spaces, no '/', not '.' or '..' */
+static bool inst_name_ok(const char *name)
+{
+	const char *c;
+
+	if (!*name || strlen(name) >= INST_NAME_MAX ||
+	    !strcmp(name, ".") || !strcmp(name, "..") ||
+	    !strcmp(name, PROC_FILENAME) || !strcmp(name, PROC_CONTROL))
+		return false;
+	for (c = name; *c; c++)
+		if (!isgraph(*c) || *c == '/')
+			return false;
+	return true;
+}
+
+
+static int control_open(struct inode *inode, struct file *file_p)
+{
+	return single_open(file_p, control_show, NULL);
+}
+
+
+static ssize_t control_write(struct file *file_p, const char __user *buffer,
+			     size_t length, loff_t *offset)
+{
+	char cmd[8 + INST_NAME_MAX], key[INST_NAME_MAX] = { 0 };
+	char *name, *op;
+	int err;
+
+	if (length >= sizeof(cmd))
+		return -EINVAL;
+	if (copy_from_user(cmd, buffer, length))
 		return -EFAULT;
+	cmd[length] = '\0';
+
+	name = strim(cmd);
+	op = strsep(&name, " ");
+	if (name == NULL)
+		return -EINVAL;
+	name = skip_spaces(name);
+	if (!inst_name_ok(name))
+		return -EINVAL;
+	strcpy(key, name);
+
+	if (!strcmp(op, "add"))
+		err = inst_add(key);
+	else if (!strcmp(op, "del"))
+		err = inst_del(key);
+	else
+		err = -EINVAL;
+
+	if (dbg_on())
+		pr_notice(MODULE_TAG "%s %s: %d\n", op, key, err);
+	return err ? err : length;
+}
+
+
+static const struct file_operations proc_control_fops = {
+	.open    = control_open,
+	.read    = seq_read,
+	.write   = control_write,
+	.llseek  = seq_lseek,
+	.release = single_release,
+};
+
+
+static int create_instances(void)
+{
+	int err;
+
+	inst_cache = KMEM_CACHE(example_inst, 0);
+	if (inst_cache == NULL)
+		return -ENOMEM;
+
+	err = rhashtable_init(&inst_table, &inst_params);
+	if (err)
+		return err;
+	inst_table_ready = true;
 
 	return 0;
 }
 
 
-static void cleanup_proc_example(void)
+static void cleanup_instances(void)
 {
-	if (proc_file) {
-		remove_proc_entry(PROC_FILENAME, proc_dir);
-		proc_file = NULL;
+	struct example_inst *inst, *tmp;
+
+	/* no more add/del, and the directory must be empty for its removal */
+	if (proc_control) {
+		remove_proc_entry(PROC_CONTROL, proc_dir);
+		proc_control = NULL;
 	}
-	if (proc_dir) {
-		remove_proc_entry(PROC_DIRECTORY, NULL);
-		proc_dir = NULL;
+	list_for_each_entry_safe(inst, tmp, &inst_list, list)
+		inst_free(inst);
+	if (inst_table_ready) {
+		rhashtable_destroy(&inst_table);
+		inst_table_ready = false;
 	}
+	kmem_cache_destroy(inst_cache);
+	inst_cache = NULL;
+}
+
+
+static int example_log_open(struct inode *inode, struct file *file_p)
+{
+	file_p->private_data = log_open();
+	return file_p->private_data ? 0 : -ENOMEM;
 }
 
 
-static int example_read(struct file *file_p, char __user *buffer,
-						size_t length, loff_t *offset)
+static int example_log_release(struct inode *inode, struct file *file_p)
 {
-	size_t left;
+	kfree(file_p->private_data);
+	return 0;
+}
 
-	if (length > (proc_msg_length - proc_msg_read_pos))
-		length = (proc_msg_length - proc_msg_read_pos);
 
-	left = copy_to_user(buffer, &proc_buffer[proc_msg_read_pos], length);
+/* set on unload, blocked log readers return 0 so the entry can go */
+static bool log_closing;
 
-	proc_msg_read_pos += length - left;
 
-	if (left)
-		pr_err(MODULE_TAG "failed to read %u from %u chars\n",
-			   left, length);
-	else
-		pr_notice(MODULE_TAG "read %u chars\n", length);
+static void log_close(void)
+{
+	WRITE_ONCE(log_closing, true);
+	wake_up_interruptible_all(&log_wait);
+}
+
+
+/* like /dev/kmsg: waits for the next record unless O_NONBLOCK */
+static ssize_t example_log_read(struct file *file_p, char __user *buffer,
+				size_t length, loff_t *offset)
+{
+	struct log_reader *r = file_p->private_data;
+	ssize_t res;
+
+	while ((res = log_read(r, buffer, length)) == -EAGAIN) {
+		if (file_p->f_flags & O_NONBLOCK)
+			break;
+		if (READ_ONCE(log_closing))
+			return 0;
+		if (wait_event_interruptible(log_wait, log_pending(r) ||
+					     READ_ONCE(log_closing)))
+			return -ERESTARTSYS;
+	}
+	return res;
+}
 
-	return length - left;
+
+static ssize_t example_log_write(struct file *file_p, const char __user *buffer,
+				 size_t length, loff_t *offset)
+{
+	if (defer_ms)
+		return defer_write(buffer, length);
+	return log_write(buffer, length);
 }
 
 
-static int example_write(struct file *file_p, const char __user *buffer,
-						 size_t length, loff_t *offset)
+static unsigned int example_log_poll(struct file *file_p, poll_table *wait)
 {
-	size_t msg_length;
-	size_t left;
+	poll_wait(file_p, &log_wait, wait);
+	if (READ_ONCE(log_closing))
+		return POLLIN | POLLRDNORM | POLLHUP;
+	return log_pending(file_p->private_data) ? POLLIN | POLLRDNORM : 0;
+}
 
-	if (length > BUFFER_SIZE) {
-		pr_warn(MODULE_TAG "reduse message length from %u to %u chars\n",
-				length, BUFFER_SIZE);
-		msg_length = BUFFER_SIZE;
-	} else
-		msg_length = length;
 
-	left = copy_from_user(proc_buffer, buffer, msg_length);
+static const struct file_operations proc_log_fops = {
+	.open    = example_log_open,
+	.release = example_log_release,
+	.read    = example_log_read,
+	.write   = example_log_write,
+	.poll    = example_log_poll,
+};
 
-	proc_msg_length = msg_length - left;
-	proc_msg_read_pos = 0;
 
-	if (left)
-		pr_err(MODULE_TAG "failed to write %u from %u chars\n",
-			   left, msg_length);
-	else
-		pr_notice(MODULE_TAG "written %u chars\n", msg_length);
+static int create_proc_example(void)
+{
+	proc_dir = proc_mkdir(PROC_DIRECTORY, NULL);
+	if (proc_dir == NULL)
+		return -EFAULT;
 
-	return length;
+	proc_file = proc_create_data(PROC_FILENAME, S_IFREG | S_IRUGO | S_IWUGO,
+							proc_dir, log_mode ? &proc_log_fops : &proc_fops,
+							&proc_buf);
+	if (proc_file == NULL)
+		return -EFAULT;
+
+	proc_control = proc_create(PROC_CONTROL, S_IFREG | S_IRUGO | S_IWUSR,
+							   proc_dir, &proc_control_fops);
+	if (proc_control == NULL)
+		return -EFAULT;
+
+	return 0;
+}
+
+
+static void cleanup_proc_example(void)
+{
+	if (proc_file) {
+		example_buf_close(&proc_buf);
+		log_close();
+		remove_proc_entry(PROC_FILENAME, proc_dir);
+		proc_file = NULL;
+	}
+	if (proc_dir) {
+		remove_proc_entry(PROC_DIRECTORY, NULL);
+		proc_dir = NULL;
+	}
 }
 
 
@@ -139,10 +602,15 @@ static int __init example_init(void)
 {
 	int err;
 
+	xevents_start();
 	err = create_buffer();
 	if (err)
 		goto error;
 
+	err = create_instances();
+	if (err)
+		goto error;
+
 	err = create_proc_example();
 	if (err)
 		goto error;
@@ -152,16 +620,20 @@ static int __init example_init(void)
 
 error:
 	pr_err(MODULE_TAG "failed to load\n");
+	cleanup_instances();
 	cleanup_proc_example();
 	cleanup_buffer();
+	xevents_stop();
 	return err;
 }
 
 
 static void __exit example_exit(void)
 {
+	cleanup_instances();
 	cleanup_proc_example();
 	cleanup_buffer();
+	xevents_stop();
 	pr_notice(MODULE_TAG "exited\n");
 }
 
@@ -0,0 +1,719 @@
+/*
+ * The procfs_rw message buffers and their read/write handlers. Included by
+ * rw.c, and built in user space by tools/core against kshim.h, so only the
+ * kernel API that kshim.h provides is used here.
+ *
+ * Every /proc/example file but the log is a struct example_buf: the
+ * 'buffer' file is proc_buf, the ones created through 'control' come from
+ * rw.c. Handlers find theirs through the struct example_file in
+ * file->private_data.
+ */
+
+#define BUFFER_SIZE		10
+
+struct example_buf {
+	/* serializes readers and writers, a write may unpin the pages being read */
+	struct mutex lock;
+	size_t msg_length;
+	size_t read_pos;
+	struct page **pinned_pages;
+	unsigned int pinned_nr;
+	size_t pinned_offset;		/* of the message in pinned_pages[0] */
+	unsigned long reads, writes;
+	unsigned long read_bytes, written_bytes;
+	/* busy-poll readers (rw.c) spin on write_seq, then sleep on wait */
+	unsigned long write_seq;
+	wait_queue_head_t wait;
+	bool closing;
+	char buffer[BUFFER_SIZE];
+};
+
+/* one per open file of an example_buf */
+struct example_file {
+	struct example_buf *buf;
+	unsigned int busy_ns;		/* spin budget, 0: reads don't wait */
+	unsigned int spin_ns;		/* the spin in use, adapts up to busy_ns */
+};
+
+static struct example_buf proc_buf;
+
+
+/* b->lock held, a new message is in place */
+static void example_buf_written(struct example_buf *b)
+{
+	WRITE_ONCE(b->write_seq, b->write_seq + 1);
+}
+
+
+/* after b->lock is dropped; the barrier of wq_has_sleeper() pairs with the
+ * sleeper's, so a reader that saw the old write_seq is woken */
+static void example_buf_wake(struct example_buf *b)
+{
+	if (wq_has_sleeper(&b->wait))
+		wake_up_interruptible(&b->wait);
+}
+
+/*
+ * Zero-copy writes: a write of at least zerocopy_min bytes pins the
+ * writer's pages instead of copying them, and the message is served from
+ * those pages until the next write unpins them. The writer must leave its
+ * buffer alone meanwhile, readers see any change it makes.
+ *
+ * At most pin_budget pages are pinned, bigger writes and failed pins fall
+ * back to the copy into the buffer.
+ */
+static unsigned long zerocopy_min;	/* 0: always copy */
+static unsigned int pin_budget = 1024;
+static unsigned long zerocopy_writes;
+static unsigned long zerocopy_fallbacks;
+
+
+static void release_pinned(struct example_buf *b)
+{
+	if (!b->pinned_pages)
+		return;
+	unpin_user_pages(b->pinned_pages, b->pinned_nr);
+	kvfree(b->pinned_pages);
+	b->pinned_pages = NULL;
+	b->pinned_nr = 0;
+}
+
+
+static int pin_message(struct example_buf *b, const char __user *buffer,
+		       size_t length)
+{
+	unsigned long start = (unsigned long)buffer;
+	unsigned int nr = DIV_ROUND_UP(offset_in_page(start) + length, PAGE_SIZE);
+	struct page **pages;
+	int got;
+
+	if (nr > pin_budget)
+		return -E2BIG;
+	pages = kvmalloc_array(nr, sizeof(*pages), GFP_KERNEL);
+	if (!pages)
+		return -ENOMEM;
+	got = pin_user_pages_fast(start & PAGE_MASK, nr, FOLL_LONGTERM, pages);
+	if (got != nr) {
+		if (got > 0)
+			unpin_user_pages(pages, got);
+		kvfree(pages);
+		return got < 0 ? got : -EFAULT;
+	}
+	b->pinned_pages = pages;
+	b->pinned_nr = nr;
+	b->pinned_offset = offset_in_page(start);
+	return 0;
+}
+
+
+/* copy_to_user() from the pinned pages, returns the bytes not copied */
+static size_t read_pinned(struct example_buf *b, char __user *buffer,
+			  size_t pos, size_t length)
+{
+	pos += b->pinned_offset;
+	while (length) {
+		struct page *page = b->pinned_pages[pos >> PAGE_SHIFT];
+		size_t off = offset_in_page(pos);
+		size_t chunk = min_t(size_t, length, PAGE_SIZE - off);
+		size_t left;
+
+		left = copy_to_user(buffer, (char *)kmap(page) + off, chunk);
+		kunmap(page);
+		if (left)
+			return length - (chunk - left);
+		buffer += chunk;
+		pos += chunk;
+		length -= chunk;
+	}
+	return 0;
+}
+
+
+/*
+ * Log mode: every write appends a record to a ring of log_size bytes
+ * instead of replacing the message, and every open file reads the records
+ * in order from its own cursor, one record per read(). When writers overrun
+ * a reader its next read() fails with -EPIPE and the cursor jumps to the
+ * oldest record left. The ring works like the printk log buffer: a record
+ * that doesn't fit at the end leaves a zero header there and starts at 0,
+ * and the oldest records are dropped to make room.
+ *
+ * log_lock is only held for a memcpy of one record, never across a user
+ * copy, so writers don't wait for readers.
+ */
+#define LOG_REC_MAX		1024
+
+static bool log_mode;
+static unsigned int log_size = 65536;
+static unsigned long log_overruns;
+
+struct log_rec {
+	u32 size;		/* of the whole record, 0: wrap to the start */
+	u32 len;		/* data bytes following the header */
+};
+
+struct log_reader {
+	u64 seq;
+	u32 idx;
+	char rec[LOG_REC_MAX];
+};
+
+static char *log_buf;
+static u64 log_first_seq, log_next_seq;
+static u32 log_first_idx, log_next_idx;
+static DEFINE_SPINLOCK(log_lock);
+static DECLARE_WAIT_QUEUE_HEAD(log_wait);
+
+
+static int log_create(void)
+{
+	log_size = roundup_pow_of_two(max_t(unsigned int, log_size,
+					    4 * LOG_REC_MAX));
+	log_buf = kvmalloc(log_size, GFP_KERNEL);
+	if (log_buf == NULL)
+		return -ENOMEM;
+	log_first_seq = log_next_seq = 0;
+	log_first_idx = log_next_idx = 0;
+	return 0;
+}
+
+
+static void log_destroy(void)
+{
+	kvfree(log_buf);
+	log_buf = NULL;
+}
+
+
+static struct log_rec *log_rec_at(u32 idx)
+{
+	struct log_rec *rec = (struct log_rec *)(log_buf + idx);
+
+	return rec->size ? rec : (struct log_rec *)log_buf;
+}
+
+
+static u32 log_next(u32 idx)
+{
+	struct log_rec *rec = (struct log_rec *)(log_buf + idx);
+
+	if (!rec->size)
+		return ((struct log_rec *)log_buf)->size;
+	return idx + rec->size;
+}
+
+
+/* room for 'size' bytes and a wrap header, log_lock held */
+static bool log_has_space(u32 size, bool empty)
+{
+	u32 free;
+
+	if (log_next_idx > log_first_idx || empty)
+		free = max(log_size - log_next_idx, log_first_idx);
+	else
+		free = log_first_idx - log_next_idx;
+	return free >= size + sizeof(struct log_rec);
+}
+
+
+/* log_lock held, the caller wakes the readers */
+static void __log_append(const char *data, u32 len)
+{
+	u32 size = ALIGN(sizeof(struct log_rec) + len, sizeof(u64));
+	struct log_rec *rec;
+
+	while (log_first_seq < log_next_seq && !log_has_space(size, false)) {
+		log_first_idx = log_next(log_first_idx);
+		log_first_seq++;
+	}
+	if (log_next_idx + size + sizeof(struct log_rec) > log_size) {
+		memset(log_buf + log_next_idx, 0, sizeof(struct log_rec));
+		log_next_idx = 0;
+	}
+	rec = (struct log_rec *)(log_buf + log_next_idx);
+	rec->size = size;
+	rec->len = len;
+	memcpy(rec + 1, data, len);
+	log_next_idx += size;
+	log_next_seq++;
+}
+
+
+static void log_append(const char *data, u32 len)
+{
+	spin_lock(&log_lock);
+	__log_append(data, len);
+	spin_unlock(&log_lock);
+
+	wake_up_interruptible(&log_wait);
+}
+
+
+static struct log_reader *log_open(void)
+{
+	struct log_reader *r = kmalloc(sizeof(*r), GFP_KERNEL);
+
+	if (r == NULL)
+		return NULL;
+	spin_lock(&log_lock);
+	r->seq = log_first_seq;
+	r->idx = log_first_idx;
+	spin_unlock(&log_lock);
+	return r;
+}
+
+
+static bool log_pending(struct log_reader *r)
+{
+	bool res;
+
+	spin_lock(&log_lock);
+	res = r->seq != log_next_seq;
+	spin_unlock(&log_lock);
+	return res;
+}
+
+
+/*
+ * Next record for the reader, -EAGAIN if there is none yet. A buffer too
+ * small for the record gets -EINVAL and the record stays.
+ */
+static ssize_t log_read(struct log_reader *r, char __user *buffer,
+			size_t length)
+{
+	struct log_rec *rec;
+	u32 len;
+
+	spin_lock(&log_lock);
+	if (r->seq < log_first_seq) {
+		r->seq = log_first_seq;
+		r->idx = log_first_idx;
+		log_overruns++;
+		spin_unlock(&log_lock);
+		return -EPIPE;
+	}
+	if (r->seq == log_next_seq) {
+		spin_unlock(&log_lock);
+		return -EAGAIN;
+	}
+	rec = log_rec_at(r->idx);
+	len = rec->len;
+	if (len > length) {
+		spin_unlock(&log_lock);
+		return -EINVAL;
+	}
+	memcpy(r->rec, rec + 1, len);
+	r->idx = log_next(r->idx);
+	r->seq++;
+	spin_unlock(&log_lock);
+
+	if (copy_to_user(buffer, r->rec, len))
+		return -EFAULT;
+	trace_example_read(len, 0);
+	return len;
+}
+
+
+/* records longer than LOG_REC_MAX are cut, like BUFFER_SIZE for a message */
+static ssize_t log_write(const char __user *buffer, size_t length)
+{
+	u32 len = min_t(size_t, length, LOG_REC_MAX);
+	char *data = kmalloc(len ? len : 1, GFP_KERNEL);
+
+	if (data == NULL)
+		return -ENOMEM;
+	if (copy_from_user(data, buffer, len)) {
+		kfree(data);
+		return -EFAULT;
+	}
+	log_append(data, len);
+	kfree(data);
+	trace_example_write(len, 0);
+	return length;
+}
+
+
+/*
+ * Deferred writes (defer_ms > 0): a write to the 'buffer' file only copies
+ * the data into a per-CPU stage and returns, defer_work publishes every
+ * stage at most defer_ms after the first write it hasn't published yet.
+ * Reads see a write once it is published.
+ *
+ * Without log_mode a stage keeps only the latest message of its CPU and a
+ * flush publishes the latest one of all of them, so a burst of overwrites
+ * costs one publish: the others count as defer_coalesced. In log_mode a
+ * stage collects up to STAGE_SIZE bytes of records and the flush appends
+ * all of them in write order under one hold of log_lock, with one wakeup;
+ * a full stage is flushed by the writer itself.
+ *
+ * The write order across CPUs is a global sequence number, one atomic
+ * increment per write. defer_writes counts the published writes,
+ * defer_lag_*_us is the age of the oldest write a flush published.
+ */
+#define STAGE_SIZE		4096
+
+static unsigned int defer_ms;		/* 0: write through */
+static unsigned long defer_writes;
+static unsigned long defer_flushes;
+static unsigned long defer_coalesced;
+static unsigned long defer_lag_max_us;
+static unsigned long defer_lag_last_us;
+
+struct stage {
+	spinlock_t lock;
+	u64 first_ns;		/* of the oldest unpublished write */
+	unsigned long writes;	/* since the last flush, 0: empty */
+	u64 seq;		/* of the message without log_mode */
+	u32 len;		/* bytes in data */
+	u32 pos;		/* merge cursor of a flush in flush_area */
+	char data[STAGE_SIZE];
+};
+
+/* a staged log record, 8 byte aligned in stage.data */
+struct stage_rec {
+	u64 seq;
+	u32 len;
+};
+
+static struct stage __percpu *stages;
+/* per-CPU snapshots taken by a flush, and the flush itself, under defer_lock */
+static struct stage *flush_area;
+static DEFINE_MUTEX(defer_lock);
+static atomic64_t defer_seq;
+
+static void defer_work_fn(struct work_struct *work);
+static DECLARE_DELAYED_WORK(defer_work, defer_work_fn);
+
+
+static int defer_create(void)
+{
+	int cpu;
+
+	stages = alloc_percpu(struct stage);
+	flush_area = kvmalloc_array(nr_cpu_ids, sizeof(*flush_area), GFP_KERNEL);
+	if (stages == NULL || flush_area == NULL) {
+		/* defer_destroy() must not flush half of it */
+		free_percpu(stages);
+		stages = NULL;
+		kvfree(flush_area);
+		flush_area = NULL;
+		return -ENOMEM;
+	}
+	for_each_possible_cpu(cpu)
+		spin_lock_init(&per_cpu_ptr(stages, cpu)->lock);
+	return 0;
+}
+
+
+/* takes the stages of all CPUs, defer_lock held, returns the writes taken */
+static unsigned long defer_collect(u64 *first_ns)
+{
+	unsigned long total = 0;
+	int cpu;
+
+	*first_ns = 0;
+	for_each_possible_cpu(cpu) {
+		struct stage *s = per_cpu_ptr(stages, cpu);
+		struct stage *f = &flush_area[cpu];
+
+		f->writes = 0;
+		if (!READ_ONCE(s->writes))
+			continue;
+		spin_lock(&s->lock);
+		f->writes = s->writes;
+		f->seq = s->seq;
+		f->len = s->len;
+		f->first_ns = s->first_ns;
+		memcpy(f->data, s->data, s->len);
+		s->writes = 0;
+		s->len = 0;
+		spin_unlock(&s->lock);
+
+		total += f->writes;
+		if (!*first_ns || f->first_ns < *first_ns)
+			*first_ns = f->first_ns;
+	}
+	return total;
+}
+
+
+/* the latest message of all stages becomes the proc_buf message */
+static void defer_publish_msg(unsigned long total)
+{
+	struct stage *latest = NULL;
+	int cpu;
+
+	for (cpu = 0; cpu < nr_cpu_ids; cpu++)
+		if (flush_area[cpu].writes &&
+		    (latest == NULL || flush_area[cpu].seq > latest->seq))
+			latest = &flush_area[cpu];
+
+	mutex_lock(&proc_buf.lock);
+	release_pinned(&proc_buf);
+	memcpy(proc_buf.buffer, latest->data, latest->len);
+	proc_buf.msg_length = latest->len;
+	proc_buf.read_pos = 0;
+	proc_buf.writes += total;
+	proc_buf.written_bytes += latest->len;
+	example_buf_written(&proc_buf);
+	mutex_unlock(&proc_buf.lock);
+	example_buf_wake(&proc_buf);
+	defer_coalesced += total - 1;
+}
+
+
+/* merges the staged records of all CPUs by sequence number */
+static void defer_publish_log(void)
+{
+	struct stage *f, *next;
+	int cpu;
+
+	for (cpu = 0; cpu < nr_cpu_ids; cpu++)
+		flush_area[cpu].pos = 0;
+
+	spin_lock(&log_lock);
+	for (;;) {
+		struct stage_rec *rec, *min = NULL;
+
+		next = NULL;
+		for (cpu = 0; cpu < nr_cpu_ids; cpu++) {
+			f = &flush_area[cpu];
+			if (!f->writes || f->pos >= f->len)
+				continue;
+			rec = (struct stage_rec *)(f->data + f->pos);
+			if (min == NULL || rec->seq < min->seq) {
+				min = rec;
+				next = f;
+			}
+		}
+		if (min == NULL)
+			break;
+		__log_append((char *)(min + 1), min->len);
+		next->pos += ALIGN(sizeof(*min) + min->len, sizeof(u64));
+	}
+	spin_unlock(&log_lock);
+
+	wake_up_interruptible(&log_wait);
+}
+
+
+static void defer_flush(void)
+{
+	unsigned long total, lag_us;
+	u64 first_ns;
+
+	mutex_lock(&defer_lock);
+	total = defer_collect(&first_ns);
+	if (total) {
+		if (log_mode)
+			defer_publish_log();
+		else
+			defer_publish_msg(total);
+		lag_us = (ktime_get_ns() - first_ns) / 1000;
+		defer_lag_last_us = lag_us;
+		if (lag_us > defer_lag_max_us)
+			defer_lag_max_us = lag_us;
+		defer_writes += total;
+		defer_flushes++;
+	}
+	mutex_unlock(&defer_lock);
+}
+
+
+static void defer_work_fn(struct work_struct *work)
+{
+	defer_flush();
+}
+
+
+static void defer_destroy(void)
+{
+	if (stages) {
+		cancel_delayed_work_sync(&defer_work);
+		defer_flush();
+		free_percpu(stages);
+		stages = NULL;
+	}
+	kvfree(flush_area);
+	flush_area = NULL;
+}
+
+
+/* like example_write and log_write, but only stages the data */
+static ssize_t defer_write(const char __user *buffer, size_t length)
+{
+	u32 max = log_mode ? LOG_REC_MAX : BUFFER_SIZE;
+	u32 len = min_t(size_t, length, max);
+	u32 need = log_mode ? ALIGN(sizeof(struct stage_rec) + len, sizeof(u64)) : len;
+	char msg[BUFFER_SIZE];
+	char *data = msg;
+	struct stage *s;
+	bool first;
+
+	if (log_mode) {
+		data = kmalloc(len ? len : 1, GFP_KERNEL);
+		if (data == NULL)
+			return -ENOMEM;
+	}
+	if (copy_from_user(data, buffer, len)) {
+		if (data != msg)
+			kfree(data);
+		return -EFAULT;
+	}
+
+	for (;;) {
+		s = raw_cpu_ptr(stages);
+		spin_lock(&s->lock);
+		if (!log_mode || s->len + need <= STAGE_SIZE)
+			break;
+		spin_unlock(&s->lock);
+		defer_flush();
+	}
+	first = !s->writes;
+	if (first)
+		s->first_ns = ktime_get_ns();
+	if (log_mode) {
+		struct stage_rec *rec = (struct stage_rec *)(s->data + s->len);
+
+		rec->seq = atomic64_inc_return(&defer_seq);
+		rec->len = len;
+		memcpy(rec + 1, data, len);
+		s->len += need;
+	} else {
+		s->seq = atomic64_inc_return(&defer_seq);
+		memcpy(s->data, data, len);
+		s->len = len;
+	}
+	s->writes++;
+	spin_unlock(&s->lock);
+	if (data != msg)
+		kfree(data);
+
+	if (first)
+		schedule_delayed_work(&defer_work, msecs_to_jiffies(defer_ms));
+	trace_example_write(len, 0);
+	return length;
+}
+
+
+static void example_buf_init(struct example_buf *b)
+{
+	memset(b, 0, sizeof(*b));
+	mutex_init(&b->lock);
+	init_waitqueue_head(&b->wait);
+}
+
+
+static void example_buf_cleanup(struct example_buf *b)
+{
+	release_pinned(b);
+	b->msg_length = 0;
+	b->read_pos = 0;
+}
+
+
+static int create_buffer(void)
+{
+	example_buf_init(&proc_buf);
+	if (log_mode && log_create())
+		return -ENOMEM;
+	if (defer_ms && defer_create())
+		return -ENOMEM;
+
+	return 0;
+}
+
+
+static void cleanup_buffer(void)
+{
+	defer_destroy();
+	log_destroy();
+	example_buf_cleanup(&proc_buf);
+}
+
+
+static int example_read(struct file *file_p, char __user *buffer,
+						size_t length, loff_t *offset)
+{
+	struct example_buf *b = ((struct example_file *)file_p->private_data)->buf;
+	size_t left;
+
+	mutex_lock(&b->lock);
+	if (length > (b->msg_length - b->read_pos))
+		length = (b->msg_length - b->read_pos);
+
+	if (b->pinned_pages)
+		left = read_pinned(b, buffer, b->read_pos, length);
+	else
+		left = copy_to_user(buffer, &b->buffer[b->read_pos], length);
+
+	b->read_pos += length - left;
+	b->reads++;
+	b->read_bytes += length - left;
+	mutex_unlock(&b->lock);
+
+	trace_example_read(length, left);
+	if (left)
+		pr_err(MODULE_TAG "failed to read %u from %u chars\n",
+			   left, length);
+	else if (dbg_on())
+		pr_notice(MODULE_TAG "read %u chars\n", length);
+
+	return length - left;
+}
+
+
+static int example_write(struct file *file_p, const char __user *buffer,
+						 size_t length, loff_t *offset)
+{
+	struct example_buf *b = ((struct example_file *)file_p->private_data)->buf;
+	size_t msg_length;
+	size_t left;
+
+	if (defer_ms && b == &proc_buf)
+		return defer_write(buffer, length);
+
+	mutex_lock(&b->lock);
+	release_pinned(b);
+	b->writes++;
+	if (zerocopy_min && length >= zerocopy_min) {
+		if (!pin_message(b, buffer, length)) {
+			zerocopy_writes++;
+			b->msg_length = length;
+			b->read_pos = 0;
+			b->written_bytes += length;
+			example_buf_written(b);
+			mutex_unlock(&b->lock);
+			example_buf_wake(b);
+			trace_example_write(length, 0);
+			return length;
+		}
+		zerocopy_fallbacks++;
+	}
+
+	if (length > BUFFER_SIZE) {
+		if (dbg_on())
+			pr_warn(MODULE_TAG "reduse message length from %u to %u chars\n",
+				length, BUFFER_SIZE);
+		msg_length = BUFFER_SIZE;
+	} else
+		msg_length = length;
+
+	left = copy_from_user(b->buffer, buffer, msg_length);
+
+	b->msg_length = msg_length - left;
+	b->read_pos = 0;
+	b->written_bytes += msg_length - left;
+	example_buf_written(b);
+	mutex_unlock(&b->lock);
+	example_buf_wake(b);
+
+	trace_example_write(msg_length, left);
+	if (left)
+		pr_err(MODULE_TAG "failed to write %u from %u chars\n",
+			   left, msg_length);
+	else if (dbg_on())
+		pr_notice(MODULE_TAG "written %u chars\n", msg_length);
+
+	return length;
+}
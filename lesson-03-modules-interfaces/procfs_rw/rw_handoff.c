@@ -0,0 +1,204 @@
+/*
+ * Writer to reader handoff latency through /proc/example/buffer: a writer
+ * pinned to one CPU writes its clock_gettime() stamp, a reader pinned to
+ * another one reads it with RW_IOC_BUSY_POLL set and takes the difference.
+ * The writer waits for the reader before the next message, so every
+ * handoff is measured from an idle reader.
+ *
+ * -b 1 makes practically every read fall back to sleeping, the wakeup
+ * baseline; -b 50000 spins up to 50 us first. The spin hits and fallbacks
+ * of the run are taken from the module parameters.
+ *
+ * usage: rw_handoff [-n messages] [-b busy ns] [-w cpu] [-r cpu] [-p path]
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "rw_ioctl.h"
+
+#define PROC_PATH	"/proc/example/buffer"
+#define PARAMS		"/sys/module/procfs_rw/parameters/"
+
+struct shared {
+	volatile unsigned long acked;
+	volatile int ready, failed;
+	double ns[];
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void pin(int cpu)
+{
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (sched_setaffinity(0, sizeof(set), &set))
+		perror("sched_setaffinity");
+}
+
+static long param(const char *name)
+{
+	char path[128];
+	long v = -1;
+	FILE *f;
+
+	snprintf(path, sizeof(path), PARAMS "%s", name);
+	f = fopen(path, "r");
+	if (f) {
+		if (fscanf(f, "%ld", &v) != 1)
+			v = -1;
+		fclose(f);
+	}
+	return v;
+}
+
+static void reader(const char *path, unsigned long n, uint32_t busy_ns,
+		   struct shared *sh)
+{
+	uint64_t stamp;
+	unsigned long i;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0 || ioctl(fd, RW_IOC_BUSY_POLL, &busy_ns)) {
+		perror(path);
+		sh->failed = 1;
+		sh->ready = 1;
+		_exit(1);
+	}
+	/* the message of an earlier run */
+	ioctl(fd, RW_IOC_BUSY_POLL, &(uint32_t){ 0 });
+	while (read(fd, &stamp, sizeof(stamp)) > 0)
+		;
+	ioctl(fd, RW_IOC_BUSY_POLL, &busy_ns);
+	sh->ready = 1;
+	for (i = 0; i < n; i++) {
+		if (read(fd, &stamp, sizeof(stamp)) != sizeof(stamp)) {
+			perror("read");
+			sh->failed = 1;
+			break;
+		}
+		sh->ns[i] = now_ns() - stamp;
+		__atomic_store_n(&sh->acked, i + 1, __ATOMIC_RELEASE);
+	}
+	close(fd);
+	_exit(0);
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *path = PROC_PATH;
+	unsigned long n = 100000, i;
+	uint32_t busy_ns = 50000;
+	int wcpu = 0, rcpu = 1, opt, fd;
+	long hits, fallbacks;
+	struct shared *sh;
+	pid_t pid;
+
+	while ((opt = getopt(argc, argv, "n:b:w:r:p:")) != -1) {
+		switch (opt) {
+		case 'n':
+			n = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			busy_ns = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			wcpu = atoi(optarg);
+			break;
+		case 'r':
+			rcpu = atoi(optarg);
+			break;
+		case 'p':
+			path = optarg;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n messages] [-b busy ns] "
+				"[-w cpu] [-r cpu] [-p path]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (!n || !busy_ns) {
+		fprintf(stderr, "-n and -b must not be 0\n");
+		return EXIT_FAILURE;
+	}
+
+	sh = mmap(NULL, sizeof(*sh) + n * sizeof(double), PROT_READ | PROT_WRITE,
+		  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (sh == MAP_FAILED) {
+		perror("mmap");
+		return EXIT_FAILURE;
+	}
+	fd = open(path, O_WRONLY);
+	if (fd < 0) {
+		perror(path);
+		return EXIT_FAILURE;
+	}
+	hits = param("busy_spin_hits");
+	fallbacks = param("busy_fallbacks");
+
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		return EXIT_FAILURE;
+	}
+	if (!pid) {
+		pin(rcpu);
+		reader(path, n, busy_ns, sh);
+	}
+	pin(wcpu);
+	while (!sh->ready)
+		;
+	/* let the reader get into its first read */
+	usleep(10000);
+	for (i = 0; i < n && !sh->failed; i++) {
+		uint64_t stamp = now_ns();
+
+		if (write(fd, &stamp, sizeof(stamp)) != sizeof(stamp)) {
+			perror("write");
+			break;
+		}
+		while (__atomic_load_n(&sh->acked, __ATOMIC_ACQUIRE) <= i &&
+		       !sh->failed)
+			;
+	}
+	waitpid(pid, NULL, 0);
+	close(fd);
+	if (sh->failed || i < n)
+		return EXIT_FAILURE;
+
+	qsort(sh->ns, n, sizeof(double), cmp_double);
+	printf("%s, writer cpu %d, reader cpu %d, busy %u ns, %lu messages\n",
+	       path, wcpu, rcpu, busy_ns, n);
+	printf("handoff ns: p50 %.0f p90 %.0f p99 %.0f p99.9 %.0f max %.0f\n",
+	       sh->ns[n / 2], sh->ns[(size_t)((n - 1) * 0.9)],
+	       sh->ns[(size_t)((n - 1) * 0.99)],
+	       sh->ns[(size_t)((n - 1) * 0.999)], sh->ns[n - 1]);
+	if (hits >= 0 && fallbacks >= 0)
+		printf("spin hits %ld, fallbacks %ld\n",
+		       param("busy_spin_hits") - hits,
+		       param("busy_fallbacks") - fallbacks);
+	return EXIT_SUCCESS;
+}
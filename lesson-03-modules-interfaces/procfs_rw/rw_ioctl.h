@@ -0,0 +1,21 @@
+#ifndef RW_IOCTL_H
+#define RW_IOCTL_H
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+/*
+ * /proc/example/buffer and the 'control' instances
+ *
+ * RW_IOC_BUSY_POLL - spin budget in ns for reads of this open file, up to
+ *                    RW_BUSY_POLL_MAX_NS. With a budget a read that finds
+ *                    the message consumed waits for the next write: it
+ *                    spins first, then sleeps (or fails with EAGAIN under
+ *                    O_NONBLOCK). 0, the default, returns 0 at once.
+ */
+#define RW_BUSY_POLL_MAX_NS 1000000
+
+#define RW_IOC_MAGIC        'e'
+#define RW_IOC_BUSY_POLL    _IOW( RW_IOC_MAGIC, 1, __u32 )
+
+#endif /* RW_IOCTL_H */
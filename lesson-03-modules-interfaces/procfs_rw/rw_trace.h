@@ -0,0 +1,39 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM procfs_rw
+
+#if !defined(_RW_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _RW_TRACE_H
+
+#include <linux/tracepoint.h>
+
+DECLARE_EVENT_CLASS(example_io,
+	TP_PROTO(size_t length, size_t left),
+	TP_ARGS(length, left),
+	TP_STRUCT__entry(
+		__field(size_t, length)
+		__field(size_t, left)
+	),
+	TP_fast_assign(
+		__entry->length = length;
+		__entry->left = left;
+	),
+	TP_printk("%zu chars, %zu not copied", __entry->length, __entry->left)
+);
+
+DEFINE_EVENT(example_io, example_read,
+	TP_PROTO(size_t length, size_t left),
+	TP_ARGS(length, left)
+);
+
+DEFINE_EVENT(example_io, example_write,
+	TP_PROTO(size_t length, size_t left),
+	TP_ARGS(length, left)
+);
+
+#endif /* _RW_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE rw_trace
+#include <trace/define_trace.h>
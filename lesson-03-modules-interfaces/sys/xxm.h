@@ -0,0 +1,23 @@
+#ifndef XXM_H
+#define XXM_H
+
+#include <linux/types.h>
+#include "xxm_ioctl.h"
+
+/*
+ * Typed xxm values for other modules, ids from xxm_ioctl.h. All of them are
+ * a table lookup and one atomic operation: no lock, no formatting, and no
+ * generation bump or sysfs_notify() - a counter that wakes its pollers on
+ * every increment would cost more than it counts.
+ *
+ * xxm_typed_add()   - adds to an s64/u64 value, -EINVAL for other types
+ * xxm_typed_set()   - sets an s64/u64/bool value (a bool to 0 or 1)
+ * xxm_typed_read()  - any value, as XXM_IOC_GET_RAW returns it; 0 for a bad id
+ * xxm_mask_assign() - sets or clears one bit of a bitmap value
+ */
+int xxm_typed_add( unsigned int id, s64 delta );
+int xxm_typed_set( unsigned int id, u64 value );
+u64 xxm_typed_read( unsigned int id );
+int xxm_mask_assign( unsigned int id, unsigned int bit, bool on );
+
+#endif /* XXM_H */
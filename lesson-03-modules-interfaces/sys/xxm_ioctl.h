@@ -0,0 +1,60 @@
+#ifndef XXM_IOCTL_H
+#define XXM_IOCTL_H
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+/*
+ * /dev/xxm - get or set any subset of the xxm values in one call.
+ * All values of one XXM_IOC_SET are applied under a single lock, so readers
+ * (sysfs or XXM_IOC_GET) see either none or all of them; a bad entry fails
+ * the whole call before anything is changed.
+ */
+#define XXM_VALUE_MAX      160        /* LEN_MSG */
+#define XXM_IOC_MAX_VALUES 64
+
+enum {
+   XXM_DATA1,
+   XXM_DATA2,
+   XXM_DATA3,
+   XXM_NR_VALUES
+};
+
+struct xxm_value {
+   __u32 id;                          /* XXM_DATA* */
+   __u32 len;                         /* SET: bytes in data, GET: returned */
+   char  data[ XXM_VALUE_MAX + 1 ];
+};
+
+struct xxm_values {
+   __u64 values;                      /* user pointer to struct xxm_value[] */
+   __u32 count;                       /* <= XXM_IOC_MAX_VALUES */
+   __u32 flags;                       /* must be 0 */
+};
+
+/*
+ * Typed values, kept as numbers rather than text (see xxm.h). XXM_IOC_GET_RAW
+ * returns all of them without formatting: s64 as two's complement, bool as
+ * 0 or 1, a bitmap as its first 64 bits. Each value is read atomically, the
+ * set is not a snapshot.
+ */
+#define XXM_MASK_BITS 64
+
+enum {
+   XXM_COUNTER,                       /* u64, /sys/class/x-class/counter */
+   XXM_OFFSET,                        /* s64, .../offset */
+   XXM_ENABLED,                       /* bool, .../enabled */
+   XXM_MASK,                          /* XXM_MASK_BITS bits, .../mask: "0-3,7" */
+   XXM_NR_TYPED
+};
+
+struct xxm_raw {
+   __u64 values[ XXM_NR_TYPED ];
+};
+
+#define XXM_IOC_MAGIC   'm'
+#define XXM_IOC_GET     _IOWR( XXM_IOC_MAGIC, 1, struct xxm_values )
+#define XXM_IOC_SET     _IOW( XXM_IOC_MAGIC, 2, struct xxm_values )
+#define XXM_IOC_GET_RAW _IOR( XXM_IOC_MAGIC, 3, struct xxm_raw )
+
+#endif /* XXM_IOCTL_H */
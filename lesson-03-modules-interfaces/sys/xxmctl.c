@@ -0,0 +1,164 @@
+/*
+ * Batched access to the xxm values through /dev/xxm:
+ *
+ *   xxmctl get [name ...]              - one XXM_IOC_GET for all names
+ *   xxmctl set name=value [name=value ...] - one XXM_IOC_SET, applied atomically
+ *   xxmctl watch [name]                - print the value (default: the
+ *                                        generation) every time it changes
+ *   xxmctl raw                         - the typed values, one XXM_IOC_GET_RAW
+ *
+ * watch is the sysfs_notify() contract: read the attribute to the end, wait
+ * for POLLPRI, lseek() back to 0 and read it again.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include "xxm_ioctl.h"
+
+static const char *names[XXM_NR_VALUES] = {
+	[XXM_DATA1] = "data1",
+	[XXM_DATA2] = "data2",
+	[XXM_DATA3] = "data3",
+};
+
+static int name_to_id(const char *name, size_t len)
+{
+	int i;
+
+	for (i = 0; i < XXM_NR_VALUES; i++)
+		if (strlen(names[i]) == len && !strncmp(names[i], name, len))
+			return i;
+	return -1;
+}
+
+static int raw(void)
+{
+	struct xxm_raw r;
+	int fd = open("/dev/xxm", O_RDONLY);
+
+	if (fd < 0) {
+		printf("open /dev/xxm error: %m\n");
+		return EXIT_FAILURE;
+	}
+	if (ioctl(fd, XXM_IOC_GET_RAW, &r)) {
+		printf("ioctl error: %m\n");
+		close(fd);
+		return EXIT_FAILURE;
+	}
+	close(fd);
+	printf("counter: %llu\n", (unsigned long long)r.values[XXM_COUNTER]);
+	printf("offset: %lld\n", (long long)r.values[XXM_OFFSET]);
+	printf("enabled: %llu\n", (unsigned long long)r.values[XXM_ENABLED]);
+	printf("mask: %#llx\n", (unsigned long long)r.values[XXM_MASK]);
+	return EXIT_SUCCESS;
+}
+
+static int watch(const char *name)
+{
+	char path[64], buf[XXM_VALUE_MAX + 2];
+	struct pollfd pfd;
+	ssize_t len;
+
+	snprintf(path, sizeof(path), "/sys/class/x-class/xxm/%s", name);
+	pfd.fd = open(path, O_RDONLY);
+	if (pfd.fd < 0) {
+		printf("open %s error: %m\n", path);
+		return EXIT_FAILURE;
+	}
+	pfd.events = POLLPRI | POLLERR;
+	for (;;) {
+		len = pread(pfd.fd, buf, sizeof(buf) - 1, 0);
+		if (len < 0) {
+			printf("read %s error: %m\n", path);
+			break;
+		}
+		buf[len] = '\0';
+		printf("%s: %s%s", name, buf,
+		       len && buf[len - 1] == '\n' ? "" : "\n");
+		fflush(stdout);
+		if (poll(&pfd, 1, -1) < 0) {
+			printf("poll error: %m\n");
+			break;
+		}
+	}
+	close(pfd.fd);
+	return EXIT_FAILURE;
+}
+
+int main(int argc, char *argv[])
+{
+	struct xxm_value vals[XXM_IOC_MAX_VALUES];
+	struct xxm_values req = { 0 };
+	int set, fd, i;
+	unsigned long cmd;
+
+	if (argc == 2 && !strcmp(argv[1], "raw"))
+		return raw();
+	if (argc >= 2 && !strcmp(argv[1], "watch")) {
+		if (argc > 2 && strcmp(argv[2], "generation") &&
+		    name_to_id(argv[2], strlen(argv[2])) < 0)
+			goto usage;
+		return watch(argc > 2 ? argv[2] : "generation");
+	}
+	if (argc < 2 || (strcmp(argv[1], "get") && strcmp(argv[1], "set")))
+		goto usage;
+	set = !strcmp(argv[1], "set");
+	if (set && argc < 3)
+		goto usage;
+
+	memset(vals, 0, sizeof(vals));
+	if (argc == 2) {
+		for (i = 0; i < XXM_NR_VALUES; i++)
+			vals[req.count++].id = i;
+	}
+	for (i = 2; i < argc && req.count < XXM_IOC_MAX_VALUES; i++) {
+		char *eq = strchr(argv[i], '=');
+		size_t len = eq ? (size_t)(eq - argv[i]) : strlen(argv[i]);
+		int id = name_to_id(argv[i], len);
+		struct xxm_value *v = &vals[req.count++];
+
+		if (id < 0 || (set && !eq)) {
+			fprintf(stderr, "bad argument: %s\n", argv[i]);
+			return EXIT_FAILURE;
+		}
+		v->id = id;
+		if (set) {
+			v->len = strlen(eq + 1);
+			if (v->len > XXM_VALUE_MAX)
+				v->len = XXM_VALUE_MAX;
+			memcpy(v->data, eq + 1, v->len);
+		}
+	}
+	req.values = (uintptr_t)vals;
+
+	fd = open("/dev/xxm", set ? O_WRONLY : O_RDONLY);
+	if (fd < 0) {
+		printf("open /dev/xxm error: %m\n");
+		return EXIT_FAILURE;
+	}
+	cmd = set ? XXM_IOC_SET : XXM_IOC_GET;
+	if (ioctl(fd, cmd, &req)) {
+		printf("ioctl error: %m\n");
+		close(fd);
+		return EXIT_FAILURE;
+	}
+	close(fd);
+
+	if (!set)
+		for (i = 0; i < (int)req.count; i++)
+			printf("%s: %.*s%s", names[vals[i].id], (int)vals[i].len,
+			       vals[i].data,
+			       vals[i].len && vals[i].data[vals[i].len - 1] == '\n' ?
+			       "" : "\n");
+	return EXIT_SUCCESS;
+
+usage:
+	fprintf(stderr, "usage: %s get [name ...] | set name=value ... | watch [name] | raw\n",
+		argv[0]);
+	return EXIT_FAILURE;
+}
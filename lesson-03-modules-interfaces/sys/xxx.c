@@ -5,10 +5,110 @@
 #include <linux/pci.h>
 #include <linux/version.h>
 #include <linux/init.h>
+#include <linux/moduleparam.h>
+#include <linux/device.h>
+#include <linux/sysfs.h>
+#include <linux/atomic.h>
+#include <linux/percpu.h>
+#include <linux/spinlock.h>
+#include <linux/ktime.h>
+#include <linux/workqueue.h>
+
+#define CREATE_TRACE_POINTS
+#include "xxx_trace.h"
+
+#include <dbgkey.h>
 
 #define LEN_MSG 160
 static char buf_msg[ LEN_MSG + 1 ] = "Hello from module!\n";
 
+/*
+ * The class file can't be polled: its directory's kobject is private to
+ * the driver core. The same message is therefore also the 'xxx' attribute
+ * of a node-less xxx_dev device, next to 'generation', the number of
+ * stores so far. Every store wakes poll()/select() on both of them with
+ * POLLPRI|POLLERR: read to the end, poll, lseek(0) and read again.
+ */
+static atomic_long_t generation = ATOMIC_LONG_INIT( 0 );
+static struct device *xxx_dev;
+
+static void notify_dev( void ) {
+   if( !xxx_dev ) return;
+   sysfs_notify( &xxx_dev->kobj, NULL, "xxx" );
+   sysfs_notify( &xxx_dev->kobj, NULL, "generation" );
+}
+
+static void xxx_changed( void ) {
+   atomic_long_inc( &generation );
+   notify_dev();
+}
+
+/*
+ * shards=1: concurrent stores don't share a cache line. A store copies into
+ * the shard of its CPU and stamps it with ktime_get_ns(); a show returns the
+ * shard with the latest stamp, so the last writer wins, or buf_msg before
+ * the first store. The shard counts the store for 'generation', and pollers
+ * are woken from notify_work within a jiffy, once for stores that close.
+ */
+static bool shards = false;
+module_param( shards, bool, 0444 );
+
+struct xxx_shard {
+   spinlock_t lock;        /* the owner CPU's stores against shows */
+   u64 stamp;              /* of the last store, 0 if none */
+   unsigned long stores;
+   char msg[ LEN_MSG + 1 ];
+};
+static struct xxx_shard __percpu *shard;
+
+static void notify_work_fn( struct work_struct *work ) {
+   notify_dev();
+}
+static DECLARE_DELAYED_WORK( notify_work, notify_work_fn );
+
+static void shard_store( const char *buf, size_t count ) {
+   struct xxx_shard *s = get_cpu_ptr( shard );
+   spin_lock( &s->lock );
+   memcpy( s->msg, buf, count );
+   s->msg[ count ] = '\0';
+   s->stores++;
+   WRITE_ONCE( s->stamp, ktime_get_ns() );
+   spin_unlock( &s->lock );
+   put_cpu_ptr( shard );
+   /* only the pending test touches the shared work while it is queued */
+   if( !delayed_work_pending( &notify_work ) )
+      schedule_delayed_work( &notify_work, 1 );
+}
+
+/* copies the newest shard to buf, false before the first store */
+static bool shard_show( char *buf ) {
+   struct xxx_shard *newest = NULL;
+   u64 latest = 0;
+   int cpu;
+   for_each_possible_cpu( cpu ) {
+      struct xxx_shard *s = per_cpu_ptr( shard, cpu );
+      u64 stamp = READ_ONCE( s->stamp );
+      if( stamp > latest ) {
+         latest = stamp;
+         newest = s;
+      }
+   }
+   if( !newest ) return false;
+   spin_lock( &newest->lock );
+   strcpy( buf, newest->msg );
+   spin_unlock( &newest->lock );
+   return true;
+}
+
+static unsigned long shard_stores( void ) {
+   unsigned long stores = 0;
+   int cpu;
+   if( !shards ) return 0;
+   for_each_possible_cpu( cpu )
+      stores += READ_ONCE( per_cpu_ptr( shard, cpu )->stores );
+   return stores;
+}
+
 /* <linux/device.h>
 LINUX_VERSION_CODE > KERNEL_VERSION(2,6,32)
 struct class_attribute {
@@ -31,9 +131,12 @@ static ssize_t xxx_show( struct class *class, struct class_attribute *attr, char
 #else
 static ssize_t xxx_show( struct class *class, char *buf ) {
 #endif
-   strcpy( buf, buf_msg );
-   printk( "read %ld\n", (long)strlen( buf ) );
-   return strlen( buf );
+   size_t count;
+   if( !shards || !shard_show( buf ) ) strcpy( buf, buf_msg );
+   count = strlen( buf );
+   trace_xxx_show( count );
+   DBG( "read %ld\n", (long)count );
+   return count;
 }
 
 /* sysfs store() method. Calls the store() method corresponding to the individual sysfs file */
@@ -42,9 +145,16 @@ static ssize_t xxx_store( struct class *class, struct class_attribute *attr, con
 #else
 static ssize_t xxx_store( struct class *class, const char *buf, size_t count ) {
 #endif
-   printk( "write %ld\n", (long)count );
-   strncpy( buf_msg, buf, count );
-   buf_msg[ count ] = '\0';
+   size_t len = min_t( size_t, count, LEN_MSG );   /* a store can be a page */
+   trace_xxx_store( count );
+   DBG( "write %ld\n", (long)count );
+   if( shards ) {
+      shard_store( buf, len );
+      return count;
+   }
+   strncpy( buf_msg, buf, len );
+   buf_msg[ len ] = '\0';
+   xxx_changed();
    return count;
 }
 
@@ -53,15 +163,53 @@ static ssize_t xxx_store( struct class *class, const char *buf, size_t count ) {
 struct class_attribute class_attr_##_name = __ATTR(_name, _mode, _show, _store) */
 CLASS_ATTR_RW( xxx );
 
+/* /sys/class/x-class/xxx_dev/{xxx,generation} */
+static ssize_t dev_xxx_show( struct device *dev, struct device_attribute *attr, char *buf ) {
+   return xxx_show( NULL, NULL, buf );
+}
+
+static ssize_t dev_xxx_store( struct device *dev, struct device_attribute *attr,
+                              const char *buf, size_t count ) {
+   return xxx_store( NULL, NULL, buf, count );
+}
+
+static ssize_t generation_show( struct device *dev, struct device_attribute *attr, char *buf ) {
+   return sprintf( buf, "%lu\n", atomic_long_read( &generation ) + shard_stores() );
+}
+
+static struct device_attribute dev_attr_xxx =
+   __ATTR( xxx, ( S_IWUSR | S_IRUGO ), dev_xxx_show, dev_xxx_store );
+static DEVICE_ATTR_RO( generation );
+
+static struct attribute *xxx_dev_attrs[] = {
+   &dev_attr_xxx.attr,
+   &dev_attr_generation.attr,
+   NULL,
+};
+ATTRIBUTE_GROUPS( xxx_dev );
+
 static struct class *x_class;
 
 int __init x_init(void) {
-   int res;
+   int res, cpu;
+   struct device *dev;
+   if( shards ) {
+      shard = alloc_percpu( struct xxx_shard );
+      if( !shard ) return -ENOMEM;
+      for_each_possible_cpu( cpu ) spin_lock_init( &per_cpu_ptr( shard, cpu )->lock );
+   }
    x_class = class_create( THIS_MODULE, "x-class" );
    if( IS_ERR( x_class ) ) printk( "bad class create\n" );
    res = class_create_file( x_class, &class_attr_xxx );
 /* <linux/device.h>
 extern int __must_check class_create_file(struct class *class, const struct class_attribute *attr); */
+   if( !res ) {
+      /* no dev_t: only the sysfs directory, no /dev node */
+      dev = device_create_with_groups( x_class, NULL, 0, NULL, xxx_dev_groups, "xxx_dev" );
+      if( IS_ERR( dev ) ) printk( "can't create xxx_dev: %ld\n", PTR_ERR( dev ) );
+      else xxx_dev = dev;
+   }
+   if( res ) free_percpu( shard );
    printk( "'xxx' module initialized %d\n", res );
    return res;
 }
@@ -70,7 +218,17 @@ void x_cleanup(void) {
 /* <linux/device.h>
 extern void class_remove_file(struct class *class, const struct class_attribute *attr); */
    class_remove_file( x_class, &class_attr_xxx );
+   /* the class file is gone, only the device's own store can notify now */
+   if( xxx_dev ) {
+      /* notify_work may still use it once its attributes are gone */
+      get_device( xxx_dev );
+      device_unregister( xxx_dev );
+      cancel_delayed_work_sync( &notify_work );
+      put_device( xxx_dev );
+   }
+   xxx_dev = NULL;
    class_destroy( x_class );
+   free_percpu( shard );
    return;
 }
 
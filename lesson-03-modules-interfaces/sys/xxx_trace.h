@@ -0,0 +1,38 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM xxx
+
+#if !defined( _XXX_TRACE_H ) || defined( TRACE_HEADER_MULTI_READ )
+#define _XXX_TRACE_H
+
+#include <linux/tracepoint.h>
+
+/* echo 1 > /sys/kernel/debug/tracing/events/xxx/enable */
+DECLARE_EVENT_CLASS( xxx_io,
+   TP_PROTO( size_t count ),
+   TP_ARGS( count ),
+   TP_STRUCT__entry(
+      __field( size_t, count )
+   ),
+   TP_fast_assign(
+      __entry->count = count;
+   ),
+   TP_printk( "%zu bytes", __entry->count )
+);
+
+DEFINE_EVENT( xxx_io, xxx_show,
+   TP_PROTO( size_t count ),
+   TP_ARGS( count )
+);
+
+DEFINE_EVENT( xxx_io, xxx_store,
+   TP_PROTO( size_t count ),
+   TP_ARGS( count )
+);
+
+#endif /* _XXX_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE xxx_trace
+#include <trace/define_trace.h>
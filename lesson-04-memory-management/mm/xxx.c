@@ -7,164 +7,808 @@
 #include <linux/init.h>
 #include <linux/gfp.h>
 #include <linux/sysfs.h>
+#include <linux/moduleparam.h>
+#include <linux/uaccess.h>
+#include <linux/mutex.h>
+#include <linux/device.h>
+#include <linux/slab.h>
+#include <linux/rcupdate.h>
+#include <linux/refcount.h>
+#include <linux/lz4.h>
+#include <linux/workqueue.h>
+#include <linux/ktime.h>
+#include <linux/vmalloc.h>
+#include <linux/math64.h>
+#include <linux/uio.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,10,0)
+#include <linux/io_uring/cmd.h>
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(6,3,0)
+#include <linux/io_uring.h>
+#endif
 
-static size_t g_buf_size = 0;
-static char* g_buf_msg   = 0;
+/* 6.4 dropped the owner of class_create() and made the callbacks const */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,4,0)
+#define X_CLASS_ARGS const struct class *class, const struct class_attribute *attr
+#define x_class_create( name ) class_create( name )
+#else
+#define X_CLASS_ARGS struct class *class, struct class_attribute *attr
+#define x_class_create( name ) class_create( THIS_MODULE, name )
+#endif
+#include "xxx_ioctl.h"
+#include <keeper.h>
+#include <xevent.h>
 
-#define MEM_CONFIG_KMALLOC 0
-#define MEM_CONFIG_KMCACHE 1
+#define CREATE_TRACE_POINTS
+#include "xxx_trace.h"
 
-#define CACHE_NAME "xxx_cache"
-#define CACHE_SIZE 160
-static struct kmem_cache* g_cache = NULL;
+#include <dbgkey.h>
 
-static void cache_constructor( void* p )
-{
-   printk( "%s constructs %p(%u)", THIS_MODULE->name, p, (p ? *(char*)p : 0) );
-}
+#include "xxx_msg.c"
 
-static int g_mem_config = MEM_CONFIG_KMALLOC;
+/* the variables are in xxx_msg.c, mem_config is fixed at load time */
 module_param_named( mem_config, g_mem_config, int, 0 );
+module_param_named( lz4_threshold, g_lz4_threshold, uint, 0644 );
+module_param_named( lz4_delay_ms, g_lz4_delay_ms, uint, 0644 );
+module_param_named( lz4_cache_kb, g_lz4_cache_kb, uint, 0644 );
+module_param_named( lz4_cache_ms, g_lz4_cache_ms, uint, 0644 );
+module_param_named( shards, g_shards, bool, 0 );
+module_param_named( cache_prefill, g_cache_prefill, uint, 0 );
 
+/*
+ * Change notification: every store, /dev/xxx write, truncate and clear
+ * bumps g_generation and wakes poll()/select() sleepers on
+ * /sys/class/x-class/xxx_dev/xxx and .../xxx_dev/generation with
+ * POLLPRI|POLLERR. A reader reads the attribute to the end, polls, then
+ * seeks back to 0 and reads it again; 'generation' is cheap to compare
+ * before re-reading a large message through /dev/xxx. The class file
+ * /sys/class/x-class/xxx holds the same message but can't be notified:
+ * its directory belongs to the driver core. Packing doesn't change the
+ * message and doesn't notify.
+ *
+ * With shards=1 a sysfs store only counts itself in its shard and the
+ * notification follows within a jiffy from g_notify_work: sysfs_notify()
+ * and an atomic bump would put shared cache lines back on the store path.
+ * Stores that close together wake pollers once.
+ */
+static atomic64_t g_generation = ATOMIC64_INIT( 0 );
+static struct device* g_device = NULL;
 
-static void initialize_memory( void )
+static void notify_device( void )
 {
-   if (g_mem_config != MEM_CONFIG_KMCACHE)
+   if (!g_device)
       return;
+   sysfs_notify( &g_device->kobj, NULL, "xxx" );
+   sysfs_notify( &g_device->kobj, NULL, "generation" );
+}
 
-   g_cache = kmem_cache_create( CACHE_NAME, CACHE_SIZE, 0/*SLAB_HWCACHE_ALIGN*/,
-      0/*SLAB_DEBUG_INITIAL*/, &cache_constructor );
-   printk( "%s %s cache: %p", THIS_MODULE->name, __FUNCTION__, g_cache );
+static void xxx_changed( void )
+{
+   atomic64_inc( &g_generation );
+   notify_device();
 }
 
-static void finalize_memory( void )
+static void notify_work_fn( struct work_struct* work )
 {
-   if (g_mem_config != MEM_CONFIG_KMCACHE)
-      return;
+   notify_device();
+}
+
+static DECLARE_DELAYED_WORK( g_notify_work, notify_work_fn );
+
+static void xxx_shard_changed( void )
+{
+   /* only look at the shared pending bit while it is set */
+   if (!delayed_work_pending( &g_notify_work ))
+      schedule_delayed_work( &g_notify_work, 1 );
+}
+
+static ssize_t xxx_show(X_CLASS_ARGS, char *buf)
+{
+   size_t count = show_from_buffer( buf );
+   trace_xxx_show( count );
+   DBG( "read %ld\n", (long)count );
+   return count;
+}
+
+static ssize_t xxx_store(X_CLASS_ARGS, const char *buf, size_t count)
+{
+   trace_xxx_store( count );
+   DBG( "write %ld\n", (long)count );
+   if (g_shards)
+   {
+      count = store_to_shard( buf, count );
+      xxx_shard_changed();
+      return count;
+   }
+   mutex_lock( &g_msg_lock );
+   count = store_to_buffer( buf, count );
+   mutex_unlock( &g_msg_lock );
+   xxx_changed();
+   return count;
+}
 
-   if (g_cache)
-      kmem_cache_destroy( g_cache );
-   g_cache = NULL;
+CLASS_ATTR_RW(xxx);
+
+static u64 per_kib( atomic64_t* ns, atomic64_t* bytes )
+{
+   u64 b = atomic64_read( bytes );
+   return b ? div64_u64( atomic64_read( ns ) * 1024, b ) : 0;
 }
 
-static void* allocate_memory( size_t* count )
+/* mem_config=2: is packing worth it for this data */
+static ssize_t lz4_stats_show(X_CLASS_ARGS, char *buf)
 {
-   void* result = NULL;
-   if (!*count)
-      return result;
+   struct xxx_msg* msg;
+   size_t len = 0, resident = 0;
+   u64 plain = atomic64_read( &g_lz4_stats.plain_bytes );
+   u64 packed = atomic64_read( &g_lz4_stats.packed_bytes );
+   u64 ratio = packed ? div64_u64( plain * 100, packed ) : 0;
 
-   if (g_mem_config == MEM_CONFIG_KMALLOC)
+   rcu_read_lock();
+   msg = rcu_dereference( g_msg );
+   if (msg)
    {
-      result = kmalloc( *count, GFP_ATOMIC );
+      len = smp_load_acquire( &msg->len );
+      resident = msg->zlen ? msg->zlen : len;
+      if (msg->zlen && READ_ONCE( msg->plain ))
+         resident += len;
    }
-   else if (g_mem_config == MEM_CONFIG_KMCACHE)
+   rcu_read_unlock();
+
+   return scnprintf( buf, PAGE_SIZE,
+      "mode: %s\n"
+      "message: %zu bytes, %zu resident\n"
+      "packed: %lld, skipped: %lld\n"
+      "ratio: %llu.%02llu (%llu -> %llu bytes)\n"
+      "pack: %llu ns/KiB\n"
+      "unpack: %llu ns/KiB\n"
+      "cache: %lld hits, %lld fills, %lld drops, %lld bytes\n",
+      g_mem_config == MEM_CONFIG_LZ4 && g_lz4_wrkmem ? "lz4" : "off",
+      len, resident,
+      atomic64_read( &g_lz4_stats.packed ), atomic64_read( &g_lz4_stats.skipped ),
+      ratio / 100, ratio % 100, plain, packed,
+      per_kib( &g_lz4_stats.pack_ns, &g_lz4_stats.pack_in ),
+      per_kib( &g_lz4_stats.unpack_ns, &g_lz4_stats.unpacked_bytes ),
+      atomic64_read( &g_lz4_stats.cache_hits ),
+      atomic64_read( &g_lz4_stats.cache_fills ),
+      atomic64_read( &g_lz4_stats.cache_drops ),
+      atomic64_read( &g_lz4_stats.cached_bytes ) );
+}
+
+CLASS_ATTR_RO(lz4_stats);
+
+static struct class *x_class;
+
+/*
+ * /dev/xxx: the same buffer without the sysfs one-page limit, and a
+ * descriptor can stay open and use pread/pwrite.
+ */
+static dev_t g_devt;
+static struct cdev g_cdev;
+
+static loff_t xxx_dev_llseek( struct file* file, loff_t offset, int whence )
+{
+   return fixed_size_llseek( file, offset, whence, msg_len() );
+}
+
+static long xxx_dev_ioctl( struct file* file, unsigned int cmd, unsigned long arg )
+{
+   struct xxx_msg* msg;
+   u64 __user* uarg = (u64 __user*)arg;
+   u64 value;
+   long res = 0;
+
+   switch (cmd)
    {
-      if (g_cache)
-      {
-         *count = CACHE_SIZE;
-         result = kmem_cache_alloc( g_cache, GFP_KERNEL );
-      }
+   case XXX_IOC_GET_LEN:
+      return put_user( (u64)msg_len(), uarg );
+
+   case XXX_IOC_GET_SIZE:
+      sync_shards();
+      rcu_read_lock();
+      msg = rcu_dereference( g_msg );
+      value = msg ? msg->size : 0;
+      rcu_read_unlock();
+      return put_user( value, uarg );
+
+   case XXX_IOC_TRUNCATE:
+      if (get_user( value, uarg ))
+         return -EFAULT;
+      mutex_lock( &g_msg_lock );
+      res = truncate_buffer( value );
+      mutex_unlock( &g_msg_lock );
+      if (!res)
+         xxx_changed();
+      return res;
+
+   case XXX_IOC_CLEAR:
+      mutex_lock( &g_msg_lock );
+      publish_msg( NULL );
+      touch_msg();
+      mutex_unlock( &g_msg_lock );
+      xxx_changed();
+      return 0;
+   }
+   return -ENOTTY;
+}
+
+static ssize_t xxx_dev_write_notify( struct file* file, const char __user* buf,
+                                     size_t count, loff_t* ppos )
+{
+   ssize_t res = xxx_dev_write( file, buf, count, ppos );
+   if (res > 0)
+      xxx_changed();
+   return res;
+}
+
+/*
+ * Asynchronous I/O: readv() and io_uring IORING_OP_READ come through
+ * read_iter. It takes a message reference and never sleeps except on a
+ * page fault; a packed message is decompressed inline into a copy from
+ * kmalloc(GFP_NOWAIT). With IOCB_NOWAIT it fails only when that allocation
+ * does, or when sysfs stores wait to be folded (shards=1); io_uring then
+ * retries from its worker. FMODE_NOWAIT tells io_uring to try inline first.
+ */
+static int xxx_dev_open( struct inode* inode, struct file* file )
+{
+#ifdef FMODE_NOWAIT
+   file->f_mode |= FMODE_NOWAIT;
+#endif
+   return 0;
+}
+
+static ssize_t xxx_dev_read_iter( struct kiocb* iocb, struct iov_iter* to )
+{
+   bool nowait = iocb->ki_flags & IOCB_NOWAIT;
+   size_t count = iov_iter_count( to );
+   struct xxx_msg* msg;
+   struct xxx_plain* tmp = NULL;
+   const char* src;
+   ssize_t res = 0;
+
+   /* folding sysfs stores takes g_msg_lock */
+   if (nowait && shards_pending())
+      return -EAGAIN;
+   msg = get_msg();
+   if (!msg)
+      goto out;
+   res = msg_bytes( msg, iocb->ki_pos, &count, &src, &tmp, nowait );
+   if (!res && count)
+   {
+      res = copy_to_iter( src, count, to );
+      if (res)
+         iocb->ki_pos += res;
       else
-      {
-         *count = 0;
-      }
+         res = -EFAULT;
    }
-   printk( "%s %s: %p/%d", THIS_MODULE->name, __FUNCTION__, result, *count );
-   return result;
+   put_plain( tmp );
+   put_msg( msg );
+out:
+   trace_xxx_show( res > 0 ? res : 0 );
+   return res;
 }
 
-static void free_memory( void** buffer )
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,3,0)
+/*
+ * IORING_OP_URING_CMD, see xxx_ioctl.h. io_uring issues the command inline
+ * with IO_URING_F_NONBLOCK first: GET and LEN don't block there (see
+ * read_iter for the exceptions), SET writes if g_msg_lock is free. A SET
+ * that finds it taken doesn't go back as -EAGAIN, which would park an
+ * io_uring worker on the mutex: its bytes are copied, the command is
+ * queued and g_ucmd_work writes everything queued under one lock hold, in
+ * submission order, then completes each command from task work of its
+ * submitter. SETs issued while others are queued queue behind them.
+ * A queued SET copies at most UCMD_SET_MAX bytes, without sleeping, and
+ * is short like a pwrite() when it had more.
+ */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,6,0)
+#define xxx_ucmd_of( c ) ( (const struct xxx_ucmd*)io_uring_sqe_cmd( (c)->sqe ) )
+#else
+#define xxx_ucmd_of( c ) ( (const struct xxx_ucmd*)(c)->sqe->cmd )
+#endif
+
+struct xxx_ucmd_set
 {
-   if (!buffer || !(*buffer))
-      return;
+   struct list_head node;
+   struct io_uring_cmd* ioucmd;
+   loff_t pos;
+   size_t count;
+   char data[];
+};
+
+#define UCMD_SET_MAX ( 4 * PAGE_SIZE )
+
+static LIST_HEAD( g_ucmd_sets );
+static DEFINE_SPINLOCK( g_ucmd_lock );
+/* SETs that took the queued path and weren't written yet, g_ucmd_lock */
+static unsigned int g_ucmd_pending;
+
+/* the result waits in the command's pdu until its task work runs */
+static void ucmd_done_tw( struct io_uring_cmd* ioucmd, unsigned int issue_flags )
+{
+   io_uring_cmd_done( ioucmd, *(ssize_t*)ioucmd->pdu, 0, issue_flags );
+}
+
+static void ucmd_work_fn( struct work_struct* work )
+{
+   struct xxx_ucmd_set *set, *next;
+   LIST_HEAD( sets );
+   unsigned int done = 0;
+   bool changed = false;
+   ssize_t res;
+
+   mutex_lock( &g_msg_lock );
+   spin_lock( &g_ucmd_lock );
+   list_splice_init( &g_ucmd_sets, &sets );
+   spin_unlock( &g_ucmd_lock );
+   list_for_each_entry_safe( set, next, &sets, node )
+   {
+      res = write_msg( NULL, set->data, set->count, &set->pos );
+      if (res > 0)
+         changed = true;
+      *(ssize_t*)set->ioucmd->pdu = res;
+      io_uring_cmd_complete_in_task( set->ioucmd, ucmd_done_tw );
+      kfree( set );
+      done++;
+   }
+   /* still under g_msg_lock, so no inline SET overtakes these */
+   spin_lock( &g_ucmd_lock );
+   g_ucmd_pending -= done;
+   spin_unlock( &g_ucmd_lock );
+   mutex_unlock( &g_msg_lock );
+   if (changed)
+      xxx_changed();
+}
+
+static DECLARE_WORK( g_ucmd_work, ucmd_work_fn );
+
+static int ucmd_set( struct io_uring_cmd* ioucmd, const char __user* buf,
+                     size_t count, loff_t pos )
+{
+   struct xxx_ucmd_set* set;
+   bool locked;
+   ssize_t res;
 
-   if (g_mem_config == MEM_CONFIG_KMALLOC)
+   /* one decision under g_ucmd_lock: write now, or queue behind the rest */
+   spin_lock( &g_ucmd_lock );
+   locked = !g_ucmd_pending && mutex_trylock( &g_msg_lock );
+   if (!locked)
+      g_ucmd_pending++;
+   spin_unlock( &g_ucmd_lock );
+   if (locked)
    {
-      kfree( *buffer );
-      *buffer = NULL;
+      res = write_msg( buf, NULL, count, &pos );
+      mutex_unlock( &g_msg_lock );
+      if (res > 0)
+         xxx_changed();
+      return res;
    }
-   else if (g_mem_config == MEM_CONFIG_KMCACHE)
+
+   count = min_t( size_t, count, UCMD_SET_MAX );
+   set = kmalloc( offsetof( struct xxx_ucmd_set, data ) + count,
+                  GFP_NOWAIT | __GFP_NOWARN );
+   res = 0;
+   if (!set)
+      res = -EAGAIN;
+   else if (copy_from_user( set->data, buf, count ))
+      res = -EFAULT;
+   if (res)
    {
-      if (g_cache)
-         kmem_cache_free( g_cache, *buffer );
-      *buffer = NULL;
+      kfree( set );
+      spin_lock( &g_ucmd_lock );
+      g_ucmd_pending--;
+      spin_unlock( &g_ucmd_lock );
+      return res;
    }
+   set->ioucmd = ioucmd;
+   set->pos = pos;
+   set->count = count;
+   spin_lock( &g_ucmd_lock );
+   list_add_tail( &set->node, &g_ucmd_sets );
+   spin_unlock( &g_ucmd_lock );
+   schedule_work( &g_ucmd_work );
+   return -EIOCBQUEUED;
 }
 
-static size_t construct_buffer( size_t* new_count )
+static int xxx_dev_uring_cmd( struct io_uring_cmd* ioucmd,
+                              unsigned int issue_flags )
 {
-   size_t result = *new_count;
-   if (!*new_count)
-      return result;
+   const struct xxx_ucmd* ucmd = xxx_ucmd_of( ioucmd );
+   bool nowait = issue_flags & IO_URING_F_NONBLOCK;
+   /* the SQE is shared with user space, read every field once */
+   void __user* buf = u64_to_user_ptr( READ_ONCE( ucmd->addr ) );
+   size_t count = min_t( u32, READ_ONCE( ucmd->len ), INT_MAX );
+   loff_t pos = READ_ONCE( ucmd->off );
+   ssize_t res;
 
-   if (*new_count >= g_buf_size)
+   switch (ioucmd->cmd_op)
    {
-      if (g_buf_msg)
-         free_memory( (void**)&g_buf_msg );
-      g_buf_size = *new_count + 1;
-      g_buf_msg  = allocate_memory( &g_buf_size );
-      if (!g_buf_msg)
+   case XXX_UCMD_LEN:
+      if (nowait && shards_pending())
+         return -EAGAIN;
+      return min_t( size_t, msg_len(), INT_MAX );
+
+   case XXX_UCMD_GET:
+      return read_msg( buf, count, &pos, nowait );
+
+   case XXX_UCMD_SET:
+      if (!count)
+         return 0;
+      if (nowait)
+         return ucmd_set( ioucmd, buf, count, pos );
+      /* IOSQE_ASYNC: already on a worker */
+      mutex_lock( &g_msg_lock );
+      res = write_msg( buf, NULL, count, &pos );
+      mutex_unlock( &g_msg_lock );
+      if (res > 0)
+         xxx_changed();
+      return res;
+   }
+   return -ENOTTY;
+}
+
+/* queued SETs hold the file open, only the work's tail can be left */
+static void ucmd_flush( void )
+{
+   flush_work( &g_ucmd_work );
+}
+#else
+static void ucmd_flush( void )
+{
+}
+#endif
+
+static const struct file_operations xxx_dev_fops = {
+   .owner          = THIS_MODULE,
+   .open           = xxx_dev_open,
+   .read           = xxx_dev_read,
+   .read_iter      = xxx_dev_read_iter,
+   .write          = xxx_dev_write_notify,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,3,0)
+   .uring_cmd      = xxx_dev_uring_cmd,
+#endif
+   .llseek         = xxx_dev_llseek,
+   .unlocked_ioctl = xxx_dev_ioctl,
+   .compat_ioctl   = xxx_dev_ioctl,
+};
+
+/* /sys/class/x-class/xxx_dev/{xxx,generation}, see xxx_changed() */
+static ssize_t dev_xxx_show( struct device* dev, struct device_attribute* attr,
+                             char* buf )
+{
+   return xxx_show( NULL, NULL, buf );
+}
+
+static ssize_t dev_xxx_store( struct device* dev, struct device_attribute* attr,
+                              const char* buf, size_t count )
+{
+   return xxx_store( NULL, NULL, buf, count );
+}
+
+/* sysfs stores so far, for the generation count */
+static unsigned long shard_stores( void )
+{
+   unsigned long stores = 0;
+   int cpu;
+
+   if (!g_shards)
+      return 0;
+   for_each_possible_cpu( cpu )
+      stores += READ_ONCE( per_cpu_ptr( g_shard, cpu )->stores );
+   return stores;
+}
+
+static ssize_t generation_show( struct device* dev, struct device_attribute* attr,
+                                char* buf )
+{
+   return scnprintf( buf, PAGE_SIZE, "%llu\n",
+                     (u64)atomic64_read( &g_generation ) + shard_stores() );
+}
+
+static struct device_attribute dev_attr_xxx =
+   __ATTR( xxx, 0644, dev_xxx_show, dev_xxx_store );
+static DEVICE_ATTR_RO( generation );
+
+static struct attribute* xxx_dev_attrs[] = {
+   &dev_attr_xxx.attr,
+   &dev_attr_generation.attr,
+   NULL,
+};
+ATTRIBUTE_GROUPS( xxx_dev );
+
+/*
+ * "xxx" in /sys/class/x-class is already the attribute file, so the device
+ * is registered as xxx_dev and only its node is named /dev/xxx.
+ */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,2,0)
+static char* x_devnode( const struct device* dev, umode_t* mode )
+#else
+static char* x_devnode( struct device* dev, umode_t* mode )
+#endif
+{
+   return kstrdup( "xxx", GFP_KERNEL );
+}
+
+static int create_device( void )
+{
+   struct device* dev;
+   int res = alloc_chrdev_region( &g_devt, 0, 1, "xxx" );
+   if (res)
+      return res;
+
+   cdev_init( &g_cdev, &xxx_dev_fops );
+   g_cdev.owner = THIS_MODULE;
+   res = cdev_add( &g_cdev, g_devt, 1 );
+   if (res)
+      goto error_region;
+
+   x_class->devnode = x_devnode;
+   dev = device_create_with_groups( x_class, NULL, g_devt, NULL,
+                                    xxx_dev_groups, "xxx_dev" );
+   if (IS_ERR( dev ))
+   {
+      res = PTR_ERR( dev );
+      goto error_cdev;
+   }
+   g_device = dev;
+   return 0;
+
+error_cdev:
+   cdev_del( &g_cdev );
+error_region:
+   unregister_chrdev_region( g_devt, 1 );
+   return res;
+}
+
+static void destroy_device( void )
+{
+   struct device* dev = g_device;
+   if (!dev)
+      return;
+   /* g_notify_work may still use it after its attributes are gone */
+   get_device( dev );
+   device_destroy( x_class, g_devt );
+   cancel_delayed_work_sync( &g_notify_work );
+   g_device = NULL;
+   put_device( dev );
+   cdev_del( &g_cdev );
+   unregister_chrdev_region( g_devt, 1 );
+}
+
+/*
+ * Reload without losing the message: with dep_keeper loaded (lesson 02)
+ * x_cleanup hands the published xxx_msg over to it and the next x_init
+ * publishes it again. The message is passed by reference, only
+ * kmem_cache objects are copied since g_cache goes away with the module.
+ * Bump XXX_KEEP_VERSION whenever struct xxx_msg changes.
+ */
+#define XXX_KEEP_KEY     "xxx"
+#define XXX_KEEP_VERSION 1
+
+static void keep_msg( void )
+{
+   typeof( &keeper_put ) put = symbol_get( keeper_put );
+   struct xxx_msg* msg;
+   struct xxx_msg* kept = NULL;
+   size_t size;
+
+   if (!put)
+      return;
+   cancel_delayed_work_sync( &g_pack_work );
+   mutex_lock( &g_msg_lock );
+   fold_shards();
+   msg = xxx_msg_locked();
+   /* the device and the class file are gone, nobody else holds it */
+   if (msg && refcount_read( &msg->ref ) == 1)
+   {
+      if (g_mem_config == MEM_CONFIG_KMCACHE)
       {
-         g_buf_size = 0;
-         result   = 0;
+         kept = kvmalloc( offsetof( struct xxx_msg, data ) + msg->len, GFP_KERNEL );
+         if (kept)
+         {
+            memcpy( kept->data, msg->data, msg->len );
+            kept->size = kept->len = msg->len;
+            kept->zlen = 0;
+         }
       }
       else
       {
-         result = g_buf_size - 1;
+         kept = msg;
+         rcu_assign_pointer( g_msg, NULL );
+         put_plain( xchg( &kept->plain, NULL ) );
       }
    }
-   *new_count = result;
-   printk( "%s %s: %p/%d", THIS_MODULE->name, __FUNCTION__, g_buf_msg, *new_count );
-   return result;
-}
+   mutex_unlock( &g_msg_lock );
 
-static size_t store_to_buffer( char const* buffer_from, size_t count )
-{
-   if (construct_buffer( &count ))
+   if (kept)
    {
-      strncpy( g_buf_msg, buffer_from, count );
-      g_buf_msg[ count ] = '\0';
+      kept->plain = NULL;
+      size = offsetof( struct xxx_msg, data ) + kept->size;
+      if (put( XXX_KEEP_KEY, XXX_KEEP_VERSION, kept, size ))
+         kvfree( kept );
    }
-   return count;
+   symbol_put( keeper_put );
 }
 
-static ssize_t xxx_show(struct class *class, struct class_attribute *attr,
-                  char *buf)
+/* true if the message kept by the previous instance was published */
+static bool adopt_msg( void )
 {
-   size_t count = 0;
-   if (g_buf_msg)
+   typeof( &keeper_take ) take = symbol_get( keeper_take );
+   struct xxx_msg* kept;
+   struct xxx_msg* msg;
+   size_t size = 0, count;
+   bool adopted = false;
+
+   if (!take)
+      return false;
+   kept = take( XXX_KEEP_KEY, XXX_KEEP_VERSION, &size );
+   symbol_put( keeper_take );
+   if (!kept)
+      return false;
+   if (size < offsetof( struct xxx_msg, data ) ||
+       size != offsetof( struct xxx_msg, data ) + kept->size ||
+       kept->len > kept->size || kept->zlen > kept->size)
    {
-      strcpy( buf, g_buf_msg );
-      count = strlen( buf );
+      kvfree( kept );
+      return false;
    }
-   printk( "read %ld\n", (long)count );
-   return count;
+   refcount_set( &kept->ref, 1 );
+
+   mutex_lock( &g_msg_lock );
+   if (g_mem_config != MEM_CONFIG_KMCACHE)
+   {
+      publish_msg( kept );
+      schedule_pack( kept );
+      kept = NULL;
+      adopted = true;
+   }
+   else
+   {
+      /* into a g_cache object, cut to CACHE_SIZE like any store */
+      count = kept->len;
+      msg = construct_buffer( &count );
+      if (msg && !unpack_prefix( kept, msg->data, count, msg->size ))
+      {
+         msg->len = count;
+         publish_msg( msg );
+         adopted = true;
+      }
+      else if (msg)
+      {
+         free_memory( (void**)&msg );
+      }
+   }
+   mutex_unlock( &g_msg_lock );
+   kvfree( kept );
+
+   /* a copy that didn't fit leaves the initial message to x_init() */
+   if (adopted)
+      printk( "%s: adopted %zu bytes from the previous instance\n",
+              THIS_MODULE->name, msg_len() );
+   else
+      printk( "%s: no room for the message of the previous instance\n",
+              THIS_MODULE->name );
+   return adopted;
 }
 
-static ssize_t xxx_store(struct class *class, struct class_attribute *attr,
-                   const char *buf, size_t count)
+/*
+ * xevents=1: the trace events also go to the relay channel of <xevent.h>,
+ * /sys/kernel/debug/xevent_xxx/cpuN, xevent_buf_kb per CPU.
+ */
+static bool g_xevents = false;
+module_param_named( xevents, g_xevents, bool, 0444 );
+static unsigned int g_xevent_buf_kb = 256;
+module_param_named( xevent_buf_kb, g_xevent_buf_kb, uint, 0444 );
+
+static void xev_show( void* data, size_t count )
 {
-   printk( "write %ld\n", (long)count );
-   count = store_to_buffer( buf, count );
-   return count;
+   xevent_emit( XEVENT_XXX_SHOW, count, 0 );
 }
 
-CLASS_ATTR_RW(xxx);
+static void xev_store( void* data, size_t count )
+{
+   xevent_emit( XEVENT_XXX_STORE, count, 0 );
+}
 
-static struct class *x_class;
+static void xev_alloc( void* data, const void* ptr, size_t size )
+{
+   xevent_emit( XEVENT_XXX_ALLOC, (unsigned long)ptr, size );
+}
+
+static void xev_buffer( void* data, const void* ptr, size_t size )
+{
+   xevent_emit( XEVENT_XXX_BUFFER, (unsigned long)ptr, size );
+}
+
+static void xev_pack( void* data, size_t len, size_t zlen )
+{
+   xevent_emit( XEVENT_XXX_PACK, len, zlen );
+}
+
+/* probes xevents_start() registered, the only ones to unregister */
+static unsigned int g_xev_probes = 0;
+
+static void xevents_stop( void )
+{
+   if (!xevent_chan)
+      return;
+   if (g_xev_probes > 4)
+      unregister_trace_xxx_pack( xev_pack, NULL );
+   if (g_xev_probes > 3)
+      unregister_trace_xxx_buffer( xev_buffer, NULL );
+   if (g_xev_probes > 2)
+      unregister_trace_xxx_alloc( xev_alloc, NULL );
+   if (g_xev_probes > 1)
+      unregister_trace_xxx_store( xev_store, NULL );
+   if (g_xev_probes > 0)
+      unregister_trace_xxx_show( xev_show, NULL );
+   g_xev_probes = 0;
+   tracepoint_synchronize_unregister();
+   xevent_close();
+}
+
+static void xevents_start( void )
+{
+   int res;
+
+   if (!g_xevents)
+      return;
+   res = xevent_open( "xevent_" KBUILD_MODNAME, g_xevent_buf_kb );
+   if (!res && !(res = register_trace_xxx_show( xev_show, NULL )))
+      g_xev_probes++;
+   if (!res && !(res = register_trace_xxx_store( xev_store, NULL )))
+      g_xev_probes++;
+   if (!res && !(res = register_trace_xxx_alloc( xev_alloc, NULL )))
+      g_xev_probes++;
+   if (!res && !(res = register_trace_xxx_buffer( xev_buffer, NULL )))
+      g_xev_probes++;
+   if (!res && !(res = register_trace_xxx_pack( xev_pack, NULL )))
+      g_xev_probes++;
+   if (res)
+   {
+      printk( "%s: no event channel: %d\n", THIS_MODULE->name, res );
+      xevents_stop();
+   }
+}
 
 int __init x_init(void) {
    int res;
-   x_class = class_create( THIS_MODULE, "x-class" );
-   if( IS_ERR( x_class ) ) printk( "bad class create\n" );
+   x_class = x_class_create( "x-class" );
+   if( IS_ERR( x_class ) )
+   {
+      printk( "bad class create\n" );
+      return PTR_ERR( x_class );
+   }
    res = class_create_file( x_class, &class_attr_xxx );
    if (res)
       goto error;
+   res = class_create_file( x_class, &class_attr_lz4_stats );
+   if (res)
+   {
+      class_remove_file( x_class, &class_attr_xxx );
+      goto error;
+   }
 
+   xevents_start();
    initialize_memory();
+   if (!adopt_msg())
    {
       char const* const initial_buffer = "Hi!\n";
+      mutex_lock( &g_msg_lock );
       store_to_buffer( initial_buffer, strlen( initial_buffer ) );
+      mutex_unlock( &g_msg_lock );
+   }
+
+   res = create_device();
+   if (res)
+   {
+      class_remove_file( x_class, &class_attr_lz4_stats );
+      class_remove_file( x_class, &class_attr_xxx );
+      release_msg();
+      finalize_memory();
+      xevents_stop();
+      class_destroy( x_class );
    }
 
 error:
@@ -173,9 +817,15 @@ error:
 }
 
 void x_cleanup(void) {
-   free_memory( (void**)&g_buf_msg );
-   finalize_memory();
+   /* no class store may notify the device while it goes */
    class_remove_file( x_class, &class_attr_xxx );
+   ucmd_flush();
+   destroy_device();
+   class_remove_file( x_class, &class_attr_lz4_stats );
+   keep_msg();
+   release_msg();
+   finalize_memory();
+   xevents_stop();
    class_destroy( x_class );
    return;
 }
@@ -0,0 +1,123 @@
+/*
+ * /dev/xxx vs /sys/class/x-class/xxx: pwrite + pread of one message,
+ * for small and large messages. sysfs is limited to one page, so the
+ * larger sizes run on the character device only.
+ *
+ * usage: xxx_bench [-n ops]   (load xxx.ko with mem_config=0)
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include "xxx_ioctl.h"
+
+#define SYSFS_PATH	"/sys/class/x-class/xxx"
+#define DEV_PATH	"/dev/xxx"
+#define SYSFS_MAX	4000
+
+static const size_t sizes[] = { 16, 256, 4000, 65536, 1 << 20 };
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int run(const char *path, size_t size, unsigned long ops,
+	       char *msg, char *buf)
+{
+	double t, w_ns, r_ns;
+	unsigned long i;
+	ssize_t res;
+	int fd = open(path, O_RDWR);
+
+	if (fd < 0) {
+		printf("%-24s %8zu  open error: %m\n", path, size);
+		return -1;
+	}
+
+	t = now_s();
+	for (i = 0; i < ops; i++) {
+		res = pwrite(fd, msg, size, 0);
+		if (res != (ssize_t)size) {
+			printf("%s: write %zd of %zu: %m\n", path, res, size);
+			close(fd);
+			return -1;
+		}
+	}
+	w_ns = (now_s() - t) * 1e9 / ops;
+
+	t = now_s();
+	for (i = 0; i < ops; i++) {
+		res = pread(fd, buf, size + 1, 0);
+		if (res != (ssize_t)size) {
+			printf("%s: read %zd of %zu: %m\n", path, res, size);
+			close(fd);
+			return -1;
+		}
+	}
+	r_ns = (now_s() - t) * 1e9 / ops;
+	close(fd);
+
+	printf("%-24s %8zu %12.0f %10.1f %12.0f %10.1f\n", path, size,
+	       w_ns, size / w_ns * 1e3, r_ns, size / r_ns * 1e3);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long ops = 100000;
+	size_t max = sizes[sizeof(sizes) / sizeof(sizes[0]) - 1], i;
+	char *msg, *buf;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:")) != -1) {
+		if (opt != 'n') {
+			fprintf(stderr, "usage: %s [-n ops]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+		ops = strtoul(optarg, NULL, 0);
+	}
+	if (!ops)
+		ops = 1;
+
+	msg = malloc(max + 1);
+	buf = malloc(max + 1);
+	if (!msg || !buf) {
+		perror("malloc");
+		return EXIT_FAILURE;
+	}
+	for (i = 0; i < max; i++)
+		msg[i] = 'a' + i % 26;
+
+	printf("%-24s %8s %12s %10s %12s %10s\n", "path", "bytes",
+	       "write ns", "MB/s", "read ns", "MB/s");
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		unsigned long n = sizes[i] > 65536 ? ops / 100 + 1 : ops;
+
+		if (sizes[i] <= SYSFS_MAX)
+			run(SYSFS_PATH, sizes[i], n, msg, buf);
+		run(DEV_PATH, sizes[i], n, msg, buf);
+	}
+
+	{
+		int fd = open(DEV_PATH, O_RDONLY);
+		__u64 len = 0, cap = 0;
+
+		if (fd >= 0 && !ioctl(fd, XXX_IOC_GET_LEN, &len) &&
+		    !ioctl(fd, XXX_IOC_GET_SIZE, &cap))
+			printf("message %llu bytes, capacity %llu bytes\n",
+			       (unsigned long long)len, (unsigned long long)cap);
+		if (fd >= 0)
+			close(fd);
+	}
+	free(msg);
+	free(buf);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,41 @@
+#ifndef XXX_IOCTL_H
+#define XXX_IOCTL_H
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+/*
+ * /dev/xxx - character device over the same buffer as /sys/class/x-class/xxx
+ *
+ * read/pread  - message bytes from the file position
+ * write/pwrite - message becomes (first pos bytes) + (written data), pos must
+ *                not be past the end of the message; pwrite at 0 replaces it
+ */
+#define XXX_IOC_MAGIC      'x'
+#define XXX_IOC_GET_LEN    _IOR( XXX_IOC_MAGIC, 1, __u64 )   /* message length */
+#define XXX_IOC_GET_SIZE   _IOR( XXX_IOC_MAGIC, 2, __u64 )   /* allocated capacity */
+#define XXX_IOC_TRUNCATE   _IOW( XXX_IOC_MAGIC, 3, __u64 )   /* shorten the message */
+#define XXX_IOC_CLEAR      _IO( XXX_IOC_MAGIC, 4 )
+
+/*
+ * io_uring IORING_OP_URING_CMD on /dev/xxx (kernel 6.3+): sqe->cmd_op is one
+ * of XXX_UCMD_*, struct xxx_ucmd goes to sqe->cmd (fits a 64-byte SQE).
+ * cqe->res is the result or -errno, as for the matching call.
+ *
+ * XXX_UCMD_GET - pread( addr, len, off )
+ * XXX_UCMD_SET - pwrite( addr, len, off ); one that has to wait for the
+ *                message lock writes at most 4 pages, check cqe->res
+ * XXX_UCMD_LEN - message length, capped at INT_MAX
+ */
+#define XXX_UCMD_GET       1
+#define XXX_UCMD_SET       2
+#define XXX_UCMD_LEN       3
+
+struct xxx_ucmd
+{
+   __u64 addr;          /* user buffer */
+   __u32 len;
+   __u32 off;           /* message offset */
+};
+
+#endif /* XXX_IOCTL_H */
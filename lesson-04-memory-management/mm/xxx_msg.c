@@ -0,0 +1,1005 @@
+/*
+ * Message storage of xxx.c: memory backends, RCU publishing, LZ4 packing
+ * and the /dev/xxx read/write paths. Included by xxx.c, and built in user
+ * space by tools/core against kshim.h, so it may only use the kernel API
+ * that kshim.h provides. Device and sysfs glue stays in xxx.c.
+ */
+
+/*
+ * The message is published through g_msg with RCU: readers (xxx_show,
+ * /dev/xxx read) never take g_msg_lock, writers build a new xxx_msg off to
+ * the side, swap the pointer and free the old one after a grace period.
+ * While an xxx_msg is published its first 'len' bytes never change and
+ * 'len' only grows, so an append that fits is done in place.
+ *
+ * In MEM_CONFIG_LZ4 mode a message that stays at lz4_threshold bytes or more
+ * for lz4_delay_ms is replaced by a packed copy: data[] holds zlen bytes of
+ * LZ4 and is never written again. Readers decompress; with lz4_cache_kb a
+ * /dev/xxx read may keep the result in 'plain' for a while, see xxx_plain.
+ */
+struct xxx_plain;
+
+struct xxx_msg {
+   struct rcu_head rcu;
+   refcount_t ref;      /* g_msg holds one, /dev/xxx readers take theirs */
+   size_t size;         /* room in data[] */
+   size_t len;          /* message length, packed or not */
+   size_t zlen;         /* LZ4 bytes in data[], 0 if not packed */
+   struct xxx_plain* plain;   /* cached copy of a packed message or NULL */
+   char data[];
+};
+
+/*
+ * Decompressed bytes of a packed message. Cached copies hang off msg->plain,
+ * all of them together take at most lz4_cache_kb (0, the default: none), and
+ * one that no read has used for lz4_cache_ms is dropped by g_plain_work, so
+ * an idle message costs its packed size again. Readers take a reference
+ * under rcu_read_lock(), a dropped copy goes after the last one and a grace
+ * period. Without room in the budget a read decompresses into an uncached
+ * xxx_plain of its own.
+ */
+struct xxx_plain {
+   struct rcu_head rcu;
+   refcount_t ref;      /* msg->plain holds one */
+   bool cached;         /* counted in g_lz4_stats.cached_bytes */
+   unsigned long used;  /* jiffies of the last read */
+   size_t len;
+   char data[];
+};
+
+static struct xxx_msg __rcu* g_msg = NULL;
+/* serializes writers only */
+static DEFINE_MUTEX( g_msg_lock );
+/* ktime of the last change of g_msg, for sharded stores, see xxx_shard */
+static u64 g_msg_stamp = 0;
+
+#define touch_msg() WRITE_ONCE( g_msg_stamp, ktime_get_ns() )
+
+#define xxx_msg_locked() \
+   rcu_dereference_protected( g_msg, lockdep_is_held( &g_msg_lock ) )
+
+#define MEM_CONFIG_KMALLOC 0
+#define MEM_CONFIG_KMCACHE 1
+#define MEM_CONFIG_LZ4     2
+
+#define CACHE_NAME "xxx_cache"
+#define CACHE_SIZE 160
+#define CACHE_OBJ_SIZE ( offsetof( struct xxx_msg, data ) + CACHE_SIZE )
+static struct kmem_cache* g_cache = NULL;
+
+/* runs for every object of a new slab, so only with debug=1 it says so */
+static void cache_constructor( void* p )
+{
+   DBG( "%s constructs %p", THIS_MODULE->name, p );
+}
+
+/*
+ * mem_config=1 with cache_prefill=N keeps a reserve of up to N xxx_cache
+ * objects, filled at load time, so the first burst of stores after a load
+ * finds them instead of growing the slab one page and constructor run at a
+ * time. allocate_memory() takes from the reserve and refills an empty one
+ * with one kmem_cache_alloc_bulk(), free_memory() puts objects back and
+ * hands CACHE_BATCH of a full one to kmem_cache_free_bulk(). Without
+ * cache_prefill every object goes to and comes from the slab directly.
+ */
+#define CACHE_BATCH 16
+
+static unsigned int g_cache_prefill = 0;
+
+static struct
+{
+   spinlock_t lock;     /* free_memory() also runs from RCU callbacks */
+   unsigned int nr;
+   unsigned int max;
+   void** objs;
+} g_pool;
+
+static int g_mem_config = MEM_CONFIG_KMALLOC;
+
+static unsigned int g_lz4_threshold = 4096;
+static unsigned int g_lz4_delay_ms = 1000;
+static unsigned int g_lz4_cache_kb = 0;
+static unsigned int g_lz4_cache_ms = 1000;
+
+static void* g_lz4_wrkmem = NULL;   /* used under g_msg_lock */
+
+static struct
+{
+   atomic64_t packed;         /* messages packed */
+   atomic64_t skipped;        /* didn't get smaller */
+   atomic64_t pack_in;        /* bytes given to the compressor */
+   atomic64_t plain_bytes;    /* input of the packed ones */
+   atomic64_t packed_bytes;   /* and their output */
+   atomic64_t pack_ns;
+   atomic64_t unpacked_bytes;
+   atomic64_t unpack_ns;
+   atomic64_t cache_hits;
+   atomic64_t cache_fills;
+   atomic64_t cache_drops;    /* idle copies dropped */
+   atomic64_t cached_bytes;   /* in cached xxx_plain copies now */
+} g_lz4_stats;
+
+/*
+ * Sharded stores (shards=1): a sysfs store copies into the shard of its CPU
+ * and stamps it with ktime_get_ns(), it takes no shared lock and writes no
+ * shared cache line; g_msg is left alone. The message is whichever of the
+ * newest shard and g_msg has the later stamp, so the last writer wins:
+ * show_from_buffer() copies a newer shard directly, every other path folds
+ * it into g_msg first (fold_shards()), and a /dev/xxx write, truncate or
+ * clear then stamps g_msg past it. Stores are cut to what construct_buffer()
+ * would keep, so folding doesn't change them.
+ */
+#define SHARD_SIZE PAGE_SIZE
+
+struct xxx_shard
+{
+   spinlock_t lock;     /* the owner CPU's stores against readers */
+   u64 stamp;           /* of the last store, 0 if none */
+   unsigned long stores;
+   size_t len;
+   char data[SHARD_SIZE];
+};
+
+static bool g_shards = false;
+static struct xxx_shard __percpu* g_shard = NULL;
+
+
+static void initialize_memory( void )
+{
+   int cpu;
+
+   if (g_shards)
+   {
+      g_shard = alloc_percpu( struct xxx_shard );
+      if (!g_shard)
+      {
+         printk( "%s: no shards, stores go to the message", THIS_MODULE->name );
+         g_shards = false;
+      }
+      else
+      {
+         for_each_possible_cpu( cpu )
+            spin_lock_init( &per_cpu_ptr( g_shard, cpu )->lock );
+      }
+   }
+
+   if (g_mem_config == MEM_CONFIG_LZ4)
+   {
+      g_lz4_wrkmem = vmalloc( LZ4_MEM_COMPRESS );
+      if (!g_lz4_wrkmem)
+      {
+         printk( "%s: no LZ4 workspace, messages stay plain", THIS_MODULE->name );
+      }
+      return;
+   }
+   if (g_mem_config != MEM_CONFIG_KMCACHE)
+      return;
+
+   g_cache = kmem_cache_create( CACHE_NAME, CACHE_OBJ_SIZE, 0/*SLAB_HWCACHE_ALIGN*/,
+      0/*SLAB_DEBUG_INITIAL*/, &cache_constructor );
+   printk( "%s %s cache: %p", THIS_MODULE->name, __FUNCTION__, g_cache );
+   if (!g_cache || !g_cache_prefill)
+      return;
+
+   spin_lock_init( &g_pool.lock );
+   g_pool.objs = kvmalloc_array( g_cache_prefill, sizeof( void* ), GFP_KERNEL );
+   if (!g_pool.objs)
+      return;
+   g_pool.max = g_cache_prefill;
+   g_pool.nr = kmem_cache_alloc_bulk( g_cache, GFP_KERNEL, g_pool.max, g_pool.objs );
+   printk( "%s: %u of %u cache objects prefilled", THIS_MODULE->name, g_pool.nr,
+           g_pool.max );
+}
+
+static void finalize_memory( void )
+{
+   free_percpu( g_shard );
+   g_shard = NULL;
+   vfree( g_lz4_wrkmem );
+   g_lz4_wrkmem = NULL;
+   if (g_mem_config != MEM_CONFIG_KMCACHE)
+      return;
+
+   if (g_pool.nr)
+      kmem_cache_free_bulk( g_cache, g_pool.nr, g_pool.objs );
+   kvfree( g_pool.objs );
+   g_pool.objs = NULL;
+   g_pool.nr = g_pool.max = 0;
+   if (g_cache)
+      kmem_cache_destroy( g_cache );
+   g_cache = NULL;
+}
+
+/* g_cache exists */
+static void* cache_alloc( void )
+{
+   void* batch[ CACHE_BATCH ];
+   void* result = NULL;
+   unsigned long flags;
+   size_t n, i;
+
+   if (!g_pool.max)
+      return kmem_cache_alloc( g_cache, GFP_KERNEL );
+
+   spin_lock_irqsave( &g_pool.lock, flags );
+   if (g_pool.nr)
+      result = g_pool.objs[ --g_pool.nr ];
+   spin_unlock_irqrestore( &g_pool.lock, flags );
+   if (result)
+      return result;
+
+   /* empty: one batch, the first object is the caller's */
+   n = kmem_cache_alloc_bulk( g_cache, GFP_KERNEL,
+                              min_t( size_t, CACHE_BATCH, g_pool.max ), batch );
+   if (!n)
+      return kmem_cache_alloc( g_cache, GFP_KERNEL );
+   spin_lock_irqsave( &g_pool.lock, flags );
+   for (i = 1; i < n && g_pool.nr < g_pool.max; i++)
+      g_pool.objs[ g_pool.nr++ ] = batch[ i ];
+   spin_unlock_irqrestore( &g_pool.lock, flags );
+   /* frees meanwhile may have filled it */
+   if (i < n)
+      kmem_cache_free_bulk( g_cache, n - i, batch + i );
+   return batch[ 0 ];
+}
+
+/* g_cache exists, may run in softirq context */
+static void cache_free( void* obj )
+{
+   void* batch[ CACHE_BATCH ];
+   unsigned long flags;
+   size_t n = 0;
+
+   if (!g_pool.max)
+   {
+      kmem_cache_free( g_cache, obj );
+      return;
+   }
+
+   spin_lock_irqsave( &g_pool.lock, flags );
+   if (g_pool.nr == g_pool.max)
+   {
+      n = min_t( size_t, CACHE_BATCH, g_pool.nr );
+      g_pool.nr -= n;
+      memcpy( batch, g_pool.objs + g_pool.nr, n * sizeof( void* ) );
+   }
+   g_pool.objs[ g_pool.nr++ ] = obj;
+   spin_unlock_irqrestore( &g_pool.lock, flags );
+   if (n)
+      kmem_cache_free_bulk( g_cache, n, batch );
+}
+
+/*
+ * kmalloc and LZ4 messages have no size limit on /dev/xxx and appends double
+ * their room, so they come from kvmalloc(): a large one falls back to vmalloc
+ * instead of asking for megabytes of contiguous pages. Only called from
+ * process context, kvfree() is fine from the RCU callback too.
+ */
+static void* allocate_memory( size_t* count )
+{
+   void* result = NULL;
+   if (!*count)
+      return result;
+
+   if (g_mem_config == MEM_CONFIG_KMALLOC || g_mem_config == MEM_CONFIG_LZ4)
+   {
+      result = kvmalloc( *count, GFP_KERNEL );
+   }
+   else if (g_mem_config == MEM_CONFIG_KMCACHE)
+   {
+      if (g_cache)
+      {
+         *count = CACHE_OBJ_SIZE;
+         result = cache_alloc();
+      }
+      else
+      {
+         *count = 0;
+      }
+   }
+   trace_xxx_alloc( result, *count );
+   DBG( "%s %s: %p/%d", THIS_MODULE->name, __FUNCTION__, result, *count );
+   return result;
+}
+
+static void free_memory( void** buffer )
+{
+   if (!buffer || !(*buffer))
+      return;
+
+   if (g_mem_config == MEM_CONFIG_KMALLOC || g_mem_config == MEM_CONFIG_LZ4)
+   {
+      kvfree( *buffer );
+      *buffer = NULL;
+   }
+   else if (g_mem_config == MEM_CONFIG_KMCACHE)
+   {
+      if (g_cache)
+         cache_free( *buffer );
+      *buffer = NULL;
+   }
+}
+
+static void free_plain( struct xxx_plain* plain )
+{
+   if (plain->cached)
+      atomic64_sub( plain->len, &g_lz4_stats.cached_bytes );
+   kvfree( plain );
+}
+
+static void free_plain_rcu( struct rcu_head* head )
+{
+   free_plain( container_of( head, struct xxx_plain, rcu ) );
+}
+
+static void put_plain( struct xxx_plain* plain )
+{
+   if (!plain || !refcount_dec_and_test( &plain->ref ))
+      return;
+   /* a cached copy may still be in get_plain() of a reader */
+   if (plain->cached)
+      call_rcu( &plain->rcu, free_plain_rcu );
+   else
+      free_plain( plain );
+}
+
+/* the cached copy of msg with a reference, or NULL */
+static struct xxx_plain* get_plain( struct xxx_msg* msg )
+{
+   struct xxx_plain* plain;
+
+   rcu_read_lock();
+   plain = smp_load_acquire( &msg->plain );
+   if (plain && !refcount_inc_not_zero( &plain->ref ))
+      plain = NULL;
+   rcu_read_unlock();
+   if (plain)
+      WRITE_ONCE( plain->used, jiffies );
+   return plain;
+}
+
+static void free_msg_rcu( struct rcu_head* head )
+{
+   struct xxx_msg* msg = container_of( head, struct xxx_msg, rcu );
+   /* readers of msg->plain are past a grace period and hold no msg, so no
+    * plain either; freeing it here keeps rcu_barrier() on unload enough */
+   if (msg->plain)
+      free_plain( msg->plain );
+   free_memory( (void**)&msg );
+}
+
+static void put_msg( struct xxx_msg* msg )
+{
+   if (msg && refcount_dec_and_test( &msg->ref ))
+      call_rcu( &msg->rcu, free_msg_rcu );
+}
+
+/* replaces the published message, g_msg_lock held */
+static void publish_msg( struct xxx_msg* msg )
+{
+   struct xxx_msg* old = xxx_msg_locked();
+   rcu_assign_pointer( g_msg, msg );
+   put_msg( old );
+}
+
+/*
+ * Allocates an unpublished message with room for *new_count bytes,
+ * *new_count is cut to what fits (kmem_cache objects hold CACHE_SIZE).
+ */
+static struct xxx_msg* construct_buffer( size_t* new_count )
+{
+   struct xxx_msg* msg;
+   size_t size = offsetof( struct xxx_msg, data ) + *new_count;
+
+   msg = allocate_memory( &size );
+   if (!msg)
+   {
+      *new_count = 0;
+      return NULL;
+   }
+   msg->size  = size - offsetof( struct xxx_msg, data );
+   msg->len   = 0;
+   msg->zlen  = 0;
+   msg->plain = NULL;
+   refcount_set( &msg->ref, 1 );
+   if (*new_count > msg->size)
+      *new_count = msg->size;
+   trace_xxx_buffer( msg, *new_count );
+   DBG( "%s %s: %p/%d", THIS_MODULE->name, __FUNCTION__, msg, *new_count );
+   return msg;
+}
+
+/*
+ * Copies the first 'count' bytes of the message to dst (dst_size >= count),
+ * decompressing a packed one. Doesn't sleep. Returns 0 or -EIO. Caller is in
+ * an RCU read section or holds g_msg_lock, either keeps msg->plain alive.
+ */
+static int unpack_prefix( struct xxx_msg* msg, char* dst, size_t count,
+                          size_t dst_size )
+{
+   struct xxx_plain* plain;
+   u64 start;
+   int res;
+
+   if (!count)
+      return 0;
+   if (!msg->zlen)
+   {
+      memcpy( dst, msg->data, count );
+      return 0;
+   }
+   plain = smp_load_acquire( &msg->plain );
+   if (plain)
+   {
+      memcpy( dst, plain->data, count );
+      WRITE_ONCE( plain->used, jiffies );
+      atomic64_inc( &g_lz4_stats.cache_hits );
+      return 0;
+   }
+
+   start = ktime_get_ns();
+   res = LZ4_decompress_safe_partial( msg->data, dst, msg->zlen, count,
+                                      min_t( size_t, dst_size, INT_MAX ) );
+   atomic64_add( ktime_get_ns() - start, &g_lz4_stats.unpack_ns );
+   atomic64_add( count, &g_lz4_stats.unpacked_bytes );
+   return (res < 0 || res < count) ? -EIO : 0;
+}
+
+static void plain_work_fn( struct work_struct* work );
+static DECLARE_DELAYED_WORK( g_plain_work, plain_work_fn );
+
+/* takes msg->len bytes of the lz4_cache_kb budget if they are there */
+static bool reserve_plain( size_t len )
+{
+   u64 budget = (u64)READ_ONCE( g_lz4_cache_kb ) * 1024;
+
+   if (!budget || len > budget)
+      return false;
+   if (atomic64_add_return( len, &g_lz4_stats.cached_bytes ) <= budget)
+      return true;
+   atomic64_sub( len, &g_lz4_stats.cached_bytes );
+   return false;
+}
+
+/*
+ * At least the first 'count' bytes of a packed message for /dev/xxx read,
+ * caller holds a reference to msg and put_plain()s the result. The whole
+ * message is decompressed and cached when the budget has room for it.
+ * With nowait the copy comes from kmalloc without sleeping; decompressing
+ * is only CPU work, so io_uring's inline issue can do it.
+ */
+static struct xxx_plain* unpack_msg( struct xxx_msg* msg, size_t count,
+                                     bool nowait )
+{
+   struct xxx_plain* plain = get_plain( msg );
+   size_t size;
+   bool cache;
+
+   if (plain)
+   {
+      atomic64_inc( &g_lz4_stats.cache_hits );
+      return plain;
+   }
+
+   cache = reserve_plain( msg->len );
+   if (cache)
+      count = msg->len;
+   size = offsetof( struct xxx_plain, data ) + count;
+   if (nowait)
+      plain = kmalloc( size, GFP_NOWAIT | __GFP_NOWARN );
+   else
+      plain = kvmalloc( size, GFP_KERNEL );
+   if (plain)
+   {
+      plain->len = count;
+      plain->cached = cache;
+      plain->used = jiffies;
+      if (unpack_prefix( msg, plain->data, count, count ))
+      {
+         free_plain( plain );
+         return NULL;
+      }
+   }
+   else
+   {
+      if (cache)
+         atomic64_sub( msg->len, &g_lz4_stats.cached_bytes );
+      return NULL;
+   }
+   /* msg->plain's and the caller's */
+   refcount_set( &plain->ref, cache ? 2 : 1 );
+   if (cache && cmpxchg( &msg->plain, NULL, plain ))
+   {
+      /* another reader was first, this one stays the caller's */
+      atomic64_sub( plain->len, &g_lz4_stats.cached_bytes );
+      plain->cached = false;
+      refcount_set( &plain->ref, 1 );
+   }
+   else if (cache)
+   {
+      atomic64_inc( &g_lz4_stats.cache_fills );
+      schedule_delayed_work( &g_plain_work,
+                             msecs_to_jiffies( READ_ONCE( g_lz4_cache_ms ) ) );
+   }
+   return plain;
+}
+
+/* drops the cached copy of the published message once no read used it */
+static void plain_work_fn( struct work_struct* work )
+{
+   unsigned long idle = msecs_to_jiffies( READ_ONCE( g_lz4_cache_ms ) );
+   struct xxx_plain* plain = NULL;
+   struct xxx_msg* msg;
+   unsigned long used;
+
+   mutex_lock( &g_msg_lock );
+   msg = xxx_msg_locked();
+   if (msg && msg->plain)
+   {
+      used = READ_ONCE( msg->plain->used );
+      if (time_before( jiffies, used + idle ))
+      {
+         schedule_delayed_work( &g_plain_work, used + idle - jiffies );
+      }
+      else
+      {
+         plain = xchg( &msg->plain, NULL );
+         atomic64_inc( &g_lz4_stats.cache_drops );
+      }
+   }
+   mutex_unlock( &g_msg_lock );
+   put_plain( plain );
+}
+
+/* replaces the published message with a packed copy, g_msg_lock held */
+static void pack_msg( void )
+{
+   struct xxx_msg* msg = xxx_msg_locked();
+   struct xxx_msg* packed = NULL;
+   size_t bound, zlen = 0;
+   char* out;
+   u64 start;
+   int res;
+
+   if (!msg || msg->zlen || !g_lz4_wrkmem || msg->len < g_lz4_threshold ||
+       msg->len > LZ4_MAX_INPUT_SIZE)
+      return;
+
+   bound = LZ4_compressBound( msg->len );
+   out = kvmalloc( bound, GFP_KERNEL );
+   if (!out)
+      return;
+   start = ktime_get_ns();
+   res = LZ4_compress_default( msg->data, out, msg->len, bound, g_lz4_wrkmem );
+   atomic64_add( ktime_get_ns() - start, &g_lz4_stats.pack_ns );
+   atomic64_add( msg->len, &g_lz4_stats.pack_in );
+
+   if (res > 0 && res < msg->len)
+   {
+      zlen = res;
+      packed = construct_buffer( &zlen );
+   }
+   if (packed && zlen == res)
+   {
+      memcpy( packed->data, out, zlen );
+      packed->zlen = zlen;
+      packed->len  = msg->len;
+      trace_xxx_pack( msg->len, zlen );
+      atomic64_inc( &g_lz4_stats.packed );
+      atomic64_add( msg->len, &g_lz4_stats.plain_bytes );
+      atomic64_add( zlen, &g_lz4_stats.packed_bytes );
+      publish_msg( packed );
+   }
+   else
+   {
+      free_memory( (void**)&packed );
+      atomic64_inc( &g_lz4_stats.skipped );
+   }
+   kvfree( out );
+}
+
+static void pack_work_fn( struct work_struct* work )
+{
+   mutex_lock( &g_msg_lock );
+   pack_msg();
+   mutex_unlock( &g_msg_lock );
+}
+
+static DECLARE_DELAYED_WORK( g_pack_work, pack_work_fn );
+
+/* packs a large message once writes to it have settled */
+static void schedule_pack( struct xxx_msg* msg )
+{
+   if (g_mem_config != MEM_CONFIG_LZ4 || !msg || msg->zlen ||
+       msg->len < g_lz4_threshold)
+      return;
+   mod_delayed_work( system_wq, &g_pack_work,
+                     msecs_to_jiffies( g_lz4_delay_ms ) );
+}
+
+/* the shard with the latest stamp after 'after', or NULL */
+static struct xxx_shard* newest_shard( u64 after )
+{
+   struct xxx_shard* newest = NULL;
+   int cpu;
+
+   for_each_possible_cpu( cpu )
+   {
+      struct xxx_shard* shard = per_cpu_ptr( g_shard, cpu );
+      u64 stamp = READ_ONCE( shard->stamp );
+      if (stamp > after)
+      {
+         after = stamp;
+         newest = shard;
+      }
+   }
+   return newest;
+}
+
+/* a sysfs store holds something g_msg doesn't have yet */
+static bool shards_pending( void )
+{
+   return g_shards && newest_shard( READ_ONCE( g_msg_stamp ) );
+}
+
+static size_t store_to_shard( char const* buffer_from, size_t count )
+{
+   struct xxx_shard* shard;
+
+   if (g_mem_config == MEM_CONFIG_KMCACHE)
+      count = min_t( size_t, count, g_cache ? CACHE_SIZE : 0 );
+   count = min_t( size_t, count, SHARD_SIZE );
+   if (!count)
+      return 0;
+
+   shard = get_cpu_ptr( g_shard );
+   spin_lock( &shard->lock );
+   memcpy( shard->data, buffer_from, count );
+   shard->len = count;
+   shard->stores++;
+   WRITE_ONCE( shard->stamp, ktime_get_ns() );
+   spin_unlock( &shard->lock );
+   put_cpu_ptr( g_shard );
+   return count;
+}
+
+/* the bytes published, 0 when there was no room for any; g_msg_lock held */
+static size_t store_to_buffer( char const* buffer_from, size_t count )
+{
+   struct xxx_msg* msg;
+   if (!count)
+      return 0;
+
+   msg = construct_buffer( &count );
+   if (msg)
+   {
+      memcpy( msg->data, buffer_from, count );
+      msg->len = count;
+      publish_msg( msg );
+      schedule_pack( msg );
+      touch_msg();
+   }
+   return count;
+}
+
+/* publishes the newest shard if it is newer than g_msg, g_msg_lock held */
+static void fold_shards( void )
+{
+   struct xxx_shard* shard;
+   char* tmp;
+   size_t len;
+   u64 stamp;
+
+   if (!g_shards)
+      return;
+   shard = newest_shard( g_msg_stamp );
+   if (!shard)
+      return;
+   tmp = kmalloc( SHARD_SIZE, GFP_KERNEL );
+   if (!tmp)
+      return;
+   spin_lock( &shard->lock );
+   len = shard->len;
+   stamp = shard->stamp;
+   memcpy( tmp, shard->data, len );
+   spin_unlock( &shard->lock );
+   /* stores that landed meanwhile are newer and fold next time; one that
+    * didn't fit stays newer than g_msg and is tried again */
+   if (store_to_buffer( tmp, len ))
+      WRITE_ONCE( g_msg_stamp, stamp );
+   kfree( tmp );
+}
+
+static void sync_shards( void )
+{
+   if (!shards_pending())
+      return;
+   mutex_lock( &g_msg_lock );
+   fold_shards();
+   mutex_unlock( &g_msg_lock );
+}
+
+/* copies the newest shard to buf if it is newer than g_msg */
+static bool show_from_shard( char* buf, size_t* count )
+{
+   struct xxx_shard* shard;
+
+   if (!g_shards)
+      return false;
+   shard = newest_shard( READ_ONCE( g_msg_stamp ) );
+   if (!shard)
+      return false;
+   spin_lock( &shard->lock );
+   *count = min_t( size_t, shard->len, PAGE_SIZE - 1 );
+   memcpy( buf, shard->data, *count );
+   spin_unlock( &shard->lock );
+   return true;
+}
+
+/* sysfs side: at most one page, returns the bytes copied to buf */
+static size_t show_from_buffer( char* buf )
+{
+   struct xxx_msg* msg;
+   size_t count = 0;
+   if (show_from_shard( buf, &count ))
+      return count;
+   rcu_read_lock();
+   msg = rcu_dereference( g_msg );
+   if (msg)
+   {
+      count = min_t( size_t, smp_load_acquire( &msg->len ), PAGE_SIZE - 1 );
+      if (unpack_prefix( msg, buf, count, PAGE_SIZE ))
+         count = 0;
+   }
+   rcu_read_unlock();
+   return count;
+}
+
+/* cuts the message to len bytes, g_msg_lock held */
+static long truncate_buffer( u64 len )
+{
+   struct xxx_msg* msg;
+   struct xxx_msg* cut;
+   size_t room = len;
+
+   fold_shards();
+   msg = xxx_msg_locked();
+   if (len > (msg ? msg->len : 0))
+      return -EINVAL;
+   if (!len)
+   {
+      publish_msg( NULL );
+      touch_msg();
+      return 0;
+   }
+   if (len == msg->len)
+      return 0;
+
+   /* shrinking in place would let a later append rewrite bytes
+    * that readers of the longer message are still copying */
+   cut = construct_buffer( &room );
+   if (room != len)
+   {
+      free_memory( (void**)&cut );
+      return -ENOMEM;
+   }
+   if (unpack_prefix( msg, cut->data, len, cut->size ))
+   {
+      free_memory( (void**)&cut );
+      return -EIO;
+   }
+   cut->len = len;
+   publish_msg( cut );
+   schedule_pack( cut );
+   touch_msg();
+   return 0;
+}
+
+/*
+ * Takes a reference, copy_to_user() may sleep so RCU alone isn't enough.
+ * Folds pending sysfs stores first, which takes g_msg_lock.
+ */
+static struct xxx_msg* get_msg( void )
+{
+   struct xxx_msg* msg;
+   sync_shards();
+   rcu_read_lock();
+   do
+   {
+      msg = rcu_dereference( g_msg );
+   } while (msg && !refcount_inc_not_zero( &msg->ref ));
+   rcu_read_unlock();
+   return msg;
+}
+
+static size_t msg_len( void )
+{
+   struct xxx_msg* msg;
+   size_t len = 0;
+   sync_shards();
+   rcu_read_lock();
+   msg = rcu_dereference( g_msg );
+   if (msg)
+      len = smp_load_acquire( &msg->len );
+   rcu_read_unlock();
+   return len;
+}
+
+/*
+ * Points *src at the message bytes from pos on and cuts *count to what is
+ * there, 0 past the end. Returns 0 or -ENOMEM; with nowait a packed message
+ * whose copy can't be allocated without sleeping gives -EAGAIN instead.
+ * Caller holds a reference and put_plain()s *tmp.
+ */
+static int msg_bytes( struct xxx_msg* msg, loff_t pos, size_t* count,
+                      const char** src, struct xxx_plain** tmp, bool nowait )
+{
+   size_t len = smp_load_acquire( &msg->len );
+
+   if (pos < 0 || pos >= len)
+   {
+      *count = 0;
+      return 0;
+   }
+   *count = min_t( size_t, *count, len - pos );
+   if (!msg->zlen)
+   {
+      *src = msg->data + pos;
+      return 0;
+   }
+   *tmp = unpack_msg( msg, pos + *count, nowait );
+   if (!*tmp)
+      return nowait ? -EAGAIN : -ENOMEM;
+   *src = (*tmp)->data + pos;
+   return 0;
+}
+
+/* a read from *ppos on, see msg_bytes() for nowait */
+static ssize_t read_msg( char __user* buf, size_t count, loff_t* ppos,
+                         bool nowait )
+{
+   struct xxx_msg* msg;
+   struct xxx_plain* tmp = NULL;
+   const char* src;
+   ssize_t res = 0;
+
+   /* folding takes g_msg_lock */
+   if (nowait && shards_pending())
+      return -EAGAIN;
+   msg = get_msg();
+   if (!msg)
+      goto out;
+   res = msg_bytes( msg, *ppos, &count, &src, &tmp, nowait );
+   if (!res && count)
+   {
+      if (copy_to_user( buf, src, count ))
+      {
+         res = -EFAULT;
+      }
+      else
+      {
+         *ppos += count;
+         res = count;
+      }
+   }
+   put_plain( tmp );
+   put_msg( msg );
+out:
+   trace_xxx_show( res > 0 ? res : 0 );
+   return res;
+}
+
+static ssize_t xxx_dev_read( struct file* file, char __user* buf, size_t count,
+                             loff_t* ppos )
+{
+   return read_msg( buf, count, ppos, false );
+}
+
+/* the bytes of a write: a kernel copy when kbuf is set, else user memory */
+static int copy_in( char* dst, const char __user* buf, const char* kbuf,
+                    size_t count )
+{
+   if (kbuf)
+   {
+      memcpy( dst, kbuf, count );
+      return 0;
+   }
+   return copy_from_user( dst, buf, count ) ? -EFAULT : 0;
+}
+
+/*
+ * Appending at the end of the message writes in place when it fits, anything
+ * else (an overwrite, or no room left) goes to a new copy. Copies for appends
+ * get twice the old room, so streaming writes don't copy on every call.
+ * kbuf is a copy of buf that uring_cmd queued, or NULL. g_msg_lock held.
+ */
+static ssize_t write_msg( const char __user* buf, const char* kbuf,
+                          size_t count, loff_t* ppos )
+{
+   struct xxx_msg *old, *msg;
+   size_t pos, old_len, new_len, room;
+   ssize_t res;
+
+   fold_shards();
+   old = xxx_msg_locked();
+   old_len = old ? old->len : 0;
+   if (*ppos < 0 || *ppos > old_len)
+   {
+      res = -EINVAL;
+      goto out;
+   }
+   pos = *ppos;
+   new_len = pos + count;
+
+   if (old && !old->zlen && pos == old_len && new_len <= old->size)
+   {
+      if (copy_in( old->data + pos, buf, kbuf, count ))
+      {
+         res = -EFAULT;
+         goto out;
+      }
+      smp_store_release( &old->len, new_len );
+   }
+   else
+   {
+      room = new_len;
+      if (old && !old->zlen && pos == old_len)
+         room = max( room, 2 * old->size );
+      msg = construct_buffer( &room );
+      if (room <= pos)
+      {
+         res = msg ? -ENOSPC : -ENOMEM;
+         free_memory( (void**)&msg );
+         goto out;
+      }
+      new_len = min( new_len, room );
+      count = new_len - pos;
+      if (pos && unpack_prefix( old, msg->data, pos, msg->size ))
+      {
+         free_memory( (void**)&msg );
+         res = -EIO;
+         goto out;
+      }
+      if (copy_in( msg->data + pos, buf, kbuf, count ))
+      {
+         free_memory( (void**)&msg );
+         res = -EFAULT;
+         goto out;
+      }
+      msg->len = new_len;
+      publish_msg( msg );
+   }
+   schedule_pack( xxx_msg_locked() );
+   touch_msg();
+   *ppos = new_len;
+   res = count;
+out:
+   trace_xxx_store( count );
+   return res;
+}
+
+static ssize_t xxx_dev_write( struct file* file, const char __user* buf,
+                              size_t count, loff_t* ppos )
+{
+   ssize_t res;
+
+   if (!count)
+      return 0;
+   mutex_lock( &g_msg_lock );
+   res = write_msg( buf, NULL, count, ppos );
+   mutex_unlock( &g_msg_lock );
+   return res;
+}
+
+/* drops the message on unload, writers are gone */
+static void release_msg( void )
+{
+   cancel_delayed_work_sync( &g_pack_work );
+   cancel_delayed_work_sync( &g_plain_work );
+   mutex_lock( &g_msg_lock );
+   publish_msg( NULL );
+   mutex_unlock( &g_msg_lock );
+   /* pending free_msg_rcu() and free_plain_rcu() callbacks use g_cache and
+    * this module's text */
+   rcu_barrier();
+}
@@ -0,0 +1,242 @@
+/*
+ * Concurrent sysfs stores: 1, 2, 4, ... writer processes, each pinned to
+ * its own CPU, pwrite() the same attribute for a fixed time. Prints the
+ * total and per-writer stores per second, so a store path that scales
+ * keeps the per-writer rate flat as writers are added.
+ *
+ * Works with the xxx of lesson 03 (sys/xxx.c) and of this lesson, compare
+ * a load with shards=1 against one without. The sysfs layer itself takes
+ * a reference on the attribute for every write, so even a perfect store
+ * path stops scaling at some point.
+ *
+ * -b N times the first N stores of one writer one by one instead, right
+ * after a load: mem_config=1 with and without cache_prefill shows what
+ * growing xxx_cache costs the first burst.
+ *
+ * usage: xxx_store_bench [-w max writers] [-t seconds] [-s bytes] [-p path]
+ *        xxx_store_bench -b stores [-s bytes] [-p path]
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#define SYSFS_PATH	"/sys/class/x-class/xxx"
+
+struct slot {
+	volatile unsigned long stores;
+	volatile int failed;
+};
+
+static volatile int stop;
+
+static void on_alarm(int sig)
+{
+	stop = 1;
+}
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void writer(const char *path, int cpu, const char *msg, size_t size,
+		   struct slot *slot, volatile int *start)
+{
+	unsigned long n = 0;
+	cpu_set_t set;
+	int fd;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	sched_setaffinity(0, sizeof(set), &set);
+	fd = open(path, O_WRONLY);
+	if (fd < 0) {
+		slot->failed = 1;
+		_exit(1);
+	}
+	while (!*start)
+		;
+	while (!stop) {
+		if (pwrite(fd, msg, size, 0) != (ssize_t)size) {
+			slot->failed = 1;
+			break;
+		}
+		n++;
+	}
+	slot->stores = n;
+	close(fd);
+	_exit(0);
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* latency of each of the first 'n' stores, in the order they happened */
+static int burst(const char *path, unsigned long n, const char *msg,
+		 size_t size)
+{
+	double *ns = malloc(n * sizeof(*ns)), total = 0, head = 0, t;
+	unsigned long i, first = n < 10 ? n : 10;
+	int fd = open(path, O_WRONLY);
+
+	if (fd < 0 || !ns) {
+		perror(path);
+		free(ns);
+		return -1;
+	}
+	for (i = 0; i < n; i++) {
+		t = now_s();
+		if (pwrite(fd, msg, size, 0) != (ssize_t)size) {
+			perror(path);
+			close(fd);
+			free(ns);
+			return -1;
+		}
+		ns[i] = (now_s() - t) * 1e9;
+		total += ns[i];
+		if (i < first)
+			head += ns[i];
+	}
+	close(fd);
+	printf("%s, %zu bytes, first %lu stores\n", path, size, n);
+	printf("store 1: %.0f ns, stores 1-%lu: %.0f ns avg, all: %.0f ns avg\n",
+	       ns[0], first, head / first, total / n);
+	qsort(ns, n, sizeof(*ns), cmp_double);
+	printf("p50 %.0f ns, p99 %.0f ns, max %.0f ns\n", ns[n / 2],
+	       ns[(size_t)((n - 1) * 0.99)], ns[n - 1]);
+	free(ns);
+	return 0;
+}
+
+/* returns total stores per second, or a negative value on failure */
+static double run(const char *path, int writers, const int *cpus,
+		  unsigned int seconds, const char *msg, size_t size,
+		  struct slot *slots, volatile int *start)
+{
+	unsigned long total = 0;
+	double t;
+	int i;
+
+	*start = 0;
+	memset(slots, 0, writers * sizeof(*slots));
+	for (i = 0; i < writers; i++) {
+		pid_t pid = fork();
+
+		if (pid < 0) {
+			perror("fork");
+			return -1;
+		}
+		if (!pid) {
+			signal(SIGALRM, on_alarm);
+			alarm(seconds);
+			writer(path, cpus[i], msg, size, &slots[i], start);
+		}
+	}
+	t = now_s();
+	*start = 1;
+	while (wait(NULL) > 0)
+		;
+	t = now_s() - t;
+	for (i = 0; i < writers; i++) {
+		if (slots[i].failed) {
+			fprintf(stderr, "%s: writer %d failed\n", path, i);
+			return -1;
+		}
+		total += slots[i].stores;
+	}
+	return total / t;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *path = SYSFS_PATH;
+	unsigned int seconds = 1;
+	int max = 0, nr_cpus = 0, opt, n, cpu;
+	unsigned long stores = 0;
+	size_t size = 64;
+	struct slot *slots;
+	volatile int *start;
+	cpu_set_t allowed;
+	char *msg;
+	int *cpus;
+
+	while ((opt = getopt(argc, argv, "w:t:s:p:b:")) != -1) {
+		switch (opt) {
+		case 'w':
+			max = atoi(optarg);
+			break;
+		case 't':
+			seconds = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			size = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			path = optarg;
+			break;
+		case 'b':
+			stores = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-w max writers] [-t seconds] "
+				"[-s bytes] [-p path]\n"
+				"       %s -b stores [-s bytes] [-p path]\n",
+				argv[0], argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (!seconds)
+		seconds = 1;
+	if (!size || size > 4000)
+		size = 64;
+
+	sched_getaffinity(0, sizeof(allowed), &allowed);
+	cpus = calloc(CPU_SETSIZE, sizeof(*cpus));
+	msg = malloc(size);
+	slots = mmap(NULL, CPU_SETSIZE * sizeof(*slots) + sizeof(*start),
+		     PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (!cpus || !msg || slots == MAP_FAILED) {
+		perror("alloc");
+		return EXIT_FAILURE;
+	}
+	start = (volatile int *)(slots + CPU_SETSIZE);
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+		if (CPU_ISSET(cpu, &allowed))
+			cpus[nr_cpus++] = cpu;
+	if (!max || max > nr_cpus)
+		max = nr_cpus;
+	memset(msg, 'x', size);
+	msg[size - 1] = '\n';
+	if (stores)
+		return burst(path, stores, msg, size) ? EXIT_FAILURE : EXIT_SUCCESS;
+
+	printf("%s, %zu bytes, %u s per run\n", path, size, seconds);
+	printf("%8s %14s %14s\n", "writers", "stores/s", "per writer");
+	for (n = 1; ; n = n * 2 < max ? n * 2 : max) {
+		double rate = run(path, n, cpus, seconds, msg, size, slots, start);
+
+		if (rate < 0)
+			return EXIT_FAILURE;
+		printf("%8d %14.0f %14.0f\n", n, rate, rate / n);
+		if (n == max)
+			break;
+	}
+	free(cpus);
+	free(msg);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,78 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM xxx
+
+#if !defined( _XXX_TRACE_H ) || defined( TRACE_HEADER_MULTI_READ )
+#define _XXX_TRACE_H
+
+#include <linux/tracepoint.h>
+
+DECLARE_EVENT_CLASS( xxx_io,
+   TP_PROTO( size_t count ),
+   TP_ARGS( count ),
+   TP_STRUCT__entry(
+      __field( size_t, count )
+   ),
+   TP_fast_assign(
+      __entry->count = count;
+   ),
+   TP_printk( "%zu bytes", __entry->count )
+);
+
+DEFINE_EVENT( xxx_io, xxx_show,
+   TP_PROTO( size_t count ),
+   TP_ARGS( count )
+);
+
+DEFINE_EVENT( xxx_io, xxx_store,
+   TP_PROTO( size_t count ),
+   TP_ARGS( count )
+);
+
+DECLARE_EVENT_CLASS( xxx_mem,
+   TP_PROTO( const void* ptr, size_t size ),
+   TP_ARGS( ptr, size ),
+   TP_STRUCT__entry(
+      __field( const void*, ptr )
+      __field( size_t, size )
+   ),
+   TP_fast_assign(
+      __entry->ptr  = ptr;
+      __entry->size = size;
+   ),
+   TP_printk( "%p/%zu", __entry->ptr, __entry->size )
+);
+
+/* allocate_memory() result */
+DEFINE_EVENT( xxx_mem, xxx_alloc,
+   TP_PROTO( const void* ptr, size_t size ),
+   TP_ARGS( ptr, size )
+);
+
+/* construct_buffer() result */
+DEFINE_EVENT( xxx_mem, xxx_buffer,
+   TP_PROTO( const void* ptr, size_t size ),
+   TP_ARGS( ptr, size )
+);
+
+/* pack_msg() replaced a message with its LZ4 copy */
+TRACE_EVENT( xxx_pack,
+   TP_PROTO( size_t len, size_t zlen ),
+   TP_ARGS( len, zlen ),
+   TP_STRUCT__entry(
+      __field( size_t, len )
+      __field( size_t, zlen )
+   ),
+   TP_fast_assign(
+      __entry->len  = len;
+      __entry->zlen = zlen;
+   ),
+   TP_printk( "%zu -> %zu bytes", __entry->len, __entry->zlen )
+);
+
+#endif /* _XXX_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE xxx_trace
+#include <trace/define_trace.h>
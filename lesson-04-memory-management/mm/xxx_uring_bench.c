@@ -0,0 +1,371 @@
+/*
+ * /dev/xxx through io_uring at queue depth 1 and 32: IORING_OP_READ (the
+ * read_iter path), and XXX_UCMD_GET / XXX_UCMD_SET uring commands, with
+ * pread/pwrite as the synchronous baseline. Talks to io_uring with raw
+ * syscalls, liburing isn't needed.
+ *
+ * 'workers' is the number of io_uring worker threads (iou-wrk-*) this
+ * process has after the run: 0 means every request completed inline or
+ * from the module's own queue, without the blocking fallback. -w starts
+ * that many processes that pwrite() /dev/xxx during the io_uring runs, so
+ * XXX_UCMD_SET finds the message lock taken.
+ *
+ * usage: xxx_uring_bench [-n ops] [-s bytes] [-w writers]
+ *                        (load xxx.ko, kernel 6.3+ for the uring commands)
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <dirent.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "xxx_ioctl.h"
+
+#define DEV_PATH	"/dev/xxx"
+#define MAX_QD		32
+#define MAX_WRITERS	64
+
+enum op { OP_PREAD, OP_PWRITE, OP_READ, OP_GET, OP_SET };
+
+static const char *op_names[] = {
+	[OP_PREAD]	= "pread",
+	[OP_PWRITE]	= "pwrite",
+	[OP_READ]	= "IORING_OP_READ",
+	[OP_GET]	= "XXX_UCMD_GET",
+	[OP_SET]	= "XXX_UCMD_SET",
+};
+
+struct ring {
+	int fd;
+	unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned int *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+};
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int ring_init(struct ring *r, unsigned int entries)
+{
+	struct io_uring_params p;
+	size_t sq_len, cq_len;
+	char *sq, *cq;
+
+	memset(&p, 0, sizeof(p));
+	r->fd = syscall(SYS_io_uring_setup, entries, &p);
+	if (r->fd < 0)
+		return -1;
+
+	sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (cq_len > sq_len)
+			sq_len = cq_len;
+		cq_len = sq_len;
+	}
+	sq = mmap(NULL, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		  r->fd, IORING_OFF_SQ_RING);
+	if (sq == MAP_FAILED)
+		return -1;
+	cq = sq;
+	if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+		cq = mmap(NULL, cq_len, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+		if (cq == MAP_FAILED)
+			return -1;
+	}
+	r->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+		       PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		       r->fd, IORING_OFF_SQES);
+	if (r->sqes == MAP_FAILED)
+		return -1;
+
+	r->sq_head = (unsigned int *)(sq + p.sq_off.head);
+	r->sq_tail = (unsigned int *)(sq + p.sq_off.tail);
+	r->sq_mask = (unsigned int *)(sq + p.sq_off.ring_mask);
+	r->sq_array = (unsigned int *)(sq + p.sq_off.array);
+	r->cq_head = (unsigned int *)(cq + p.cq_off.head);
+	r->cq_tail = (unsigned int *)(cq + p.cq_off.tail);
+	r->cq_mask = (unsigned int *)(cq + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+	return 0;
+}
+
+static void ring_queue(struct ring *r, enum op op, int fd, char *buf,
+		       size_t size, unsigned int slot)
+{
+	unsigned int tail = *r->sq_tail, idx = tail & *r->sq_mask;
+	struct io_uring_sqe *sqe = &r->sqes[idx];
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->fd = fd;
+	sqe->user_data = slot;
+	if (op == OP_READ) {
+		sqe->opcode = IORING_OP_READ;
+		sqe->addr = (unsigned long)buf;
+		sqe->len = size + 1;
+		sqe->off = 0;
+	} else {
+#ifdef IORING_SETUP_SQE128
+		struct xxx_ucmd cmd = {
+			.addr = (unsigned long)buf,
+			.len = op == OP_GET ? size + 1 : size,
+			.off = 0,
+		};
+
+		sqe->opcode = IORING_OP_URING_CMD;
+		sqe->cmd_op = op == OP_GET ? XXX_UCMD_GET : XXX_UCMD_SET;
+		memcpy(sqe->cmd, &cmd, sizeof(cmd));
+#endif
+	}
+	r->sq_array[idx] = idx;
+	__atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/* reaps what is there, returns the number reaped or -1 on a bad result */
+static int ring_reap(struct ring *r, size_t size)
+{
+	unsigned int head = *r->cq_head, n = 0;
+	int res = 0;
+
+	while (head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+		struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+
+		if (cqe->res != (int)size && !res) {
+			errno = cqe->res < 0 ? -cqe->res : 0;
+			printf("cqe res %d of %zu: %m\n", cqe->res, size);
+			res = -1;
+		}
+		head++;
+		n++;
+	}
+	__atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+	return res ? res : (int)n;
+}
+
+/* keeps qd requests in flight until 'ops' completed */
+static int run_ring(struct ring *r, enum op op, int fd, char *bufs,
+		    size_t size, unsigned long ops, unsigned int qd)
+{
+	unsigned long queued = 0, done = 0;
+	unsigned int inflight = 0, slot = 0;
+	int n;
+
+	while (done < ops) {
+		unsigned int submit = 0;
+
+		while (inflight < qd && queued < ops) {
+			ring_queue(r, op, fd, bufs + (size_t)slot * (size + 1),
+				   size, slot);
+			slot = (slot + 1) % MAX_QD;
+			inflight++;
+			queued++;
+			submit++;
+		}
+		if (syscall(SYS_io_uring_enter, r->fd, submit, 1,
+			    IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR) {
+			perror("io_uring_enter");
+			return -1;
+		}
+		n = ring_reap(r, size);
+		if (n < 0)
+			return -1;
+		inflight -= n;
+		done += n;
+	}
+	return 0;
+}
+
+static int run_sync(enum op op, int fd, char *buf, size_t size,
+		    unsigned long ops)
+{
+	unsigned long i;
+	ssize_t res;
+
+	for (i = 0; i < ops; i++) {
+		res = op == OP_PREAD ? pread(fd, buf, size + 1, 0) :
+				       pwrite(fd, buf, size, 0);
+		if (res != (ssize_t)size) {
+			printf("%s %zd of %zu: %m\n", op_names[op], res, size);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int count_workers(void)
+{
+	DIR *dir = opendir("/proc/self/task");
+	struct dirent *de;
+	char path[300], comm[32];
+	int n = 0;
+
+	if (!dir)
+		return -1;
+	while ((de = readdir(dir))) {
+		FILE *f;
+
+		if (de->d_name[0] == '.')
+			continue;
+		snprintf(path, sizeof(path), "/proc/self/task/%s/comm",
+			 de->d_name);
+		f = fopen(path, "r");
+		if (!f)
+			continue;
+		if (fgets(comm, sizeof(comm), f) && !strncmp(comm, "iou-wrk", 7))
+			n++;
+		fclose(f);
+	}
+	closedir(dir);
+	return n;
+}
+
+/* contending writers, stopped with SIGKILL */
+static int start_writers(pid_t *pids, int n, const char *buf, size_t size)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0)
+			return -1;
+		if (!pids[i]) {
+			int fd = open(DEV_PATH, O_WRONLY);
+
+			while (fd >= 0 && pwrite(fd, buf, size, 0) >= 0)
+				;
+			_exit(EXIT_FAILURE);
+		}
+	}
+	return 0;
+}
+
+static void stop_writers(pid_t *pids, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (pids[i] > 0) {
+			kill(pids[i], SIGKILL);
+			waitpid(pids[i], NULL, 0);
+		}
+	}
+}
+
+static void report(enum op op, unsigned int qd, size_t size,
+		   unsigned long ops, double s, int workers)
+{
+	printf("%-16s %3u %8zu %12.0f %10.0f %8d\n", op_names[op], qd, size,
+	       s * 1e9 / ops, ops / s, workers);
+}
+
+int main(int argc, char *argv[])
+{
+	static const unsigned int depths[] = { 1, MAX_QD };
+	static const enum op ring_ops[] = { OP_SET, OP_READ, OP_GET };
+	unsigned long ops = 100000;
+	size_t size = 256, i, j;
+	pid_t pids[MAX_WRITERS] = { 0 };
+	int fd, opt, writers = 0;
+	struct ring r;
+	char *bufs;
+	double t;
+
+	while ((opt = getopt(argc, argv, "n:s:w:")) != -1) {
+		switch (opt) {
+		case 'n':
+			ops = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			size = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			writers = atoi(optarg);
+			if (writers < 0)
+				writers = 0;
+			if (writers > MAX_WRITERS)
+				writers = MAX_WRITERS;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n ops] [-s bytes] [-w writers]\n",
+				argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (!ops)
+		ops = 1;
+	if (!size)
+		size = 1;
+
+	bufs = malloc((size + 1) * MAX_QD);
+	if (!bufs) {
+		perror("malloc");
+		return EXIT_FAILURE;
+	}
+	for (i = 0; i < (size + 1) * MAX_QD; i++)
+		bufs[i] = 'a' + i % 26;
+
+	fd = open(DEV_PATH, O_RDWR);
+	if (fd < 0) {
+		perror(DEV_PATH);
+		return EXIT_FAILURE;
+	}
+	if (ring_init(&r, 2 * MAX_QD)) {
+		perror("io_uring_setup");
+		return EXIT_FAILURE;
+	}
+
+	printf("%-16s %3s %8s %12s %10s %8s\n", "op", "qd", "bytes",
+	       "ns/op", "ops/s", "workers");
+	/* writes go first, so the reads find a message of 'size' bytes */
+	for (i = 0; i < 2; i++) {
+		enum op op = i ? OP_PREAD : OP_PWRITE;
+
+		t = now_s();
+		if (run_sync(op, fd, bufs, size, ops))
+			return EXIT_FAILURE;
+		report(op, 1, size, ops, now_s() - t, 0);
+	}
+	if (writers)
+		printf("%d pwrite() writers from here on\n", writers);
+	if (start_writers(pids, writers, bufs, size)) {
+		perror("fork");
+		stop_writers(pids, writers);
+		return EXIT_FAILURE;
+	}
+	for (i = 0; i < sizeof(ring_ops) / sizeof(ring_ops[0]); i++) {
+#ifndef IORING_SETUP_SQE128
+		if (ring_ops[i] != OP_READ) {
+			printf("%-16s built without uring command headers\n",
+			       op_names[ring_ops[i]]);
+			continue;
+		}
+#endif
+		for (j = 0; j < sizeof(depths) / sizeof(depths[0]); j++) {
+			t = now_s();
+			if (run_ring(&r, ring_ops[i], fd, bufs, size, ops,
+				     depths[j]))
+				break;
+			report(ring_ops[i], depths[j], size, ops, now_s() - t,
+			       count_workers());
+		}
+	}
+	stop_writers(pids, writers);
+	close(fd);
+	free(bufs);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,272 @@
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/version.h>
+#include <linux/init.h>
+#include <linux/sched.h>
+#include <linux/time.h>
+#include <linux/ktime.h>
+#include <linux/jiffies.h>
+#include <linux/timex.h>
+#include <linux/cpumask.h>
+#include <linux/workqueue.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,11,0)
+#include <linux/sched/clock.h>
+#endif
+#ifdef CONFIG_X86
+#include <asm/tsc.h>
+#endif
+
+/*
+ * Cost of the kernel clock sources, per CPU.
+ *
+ * echo 1 > /sys/class/clkbench-class/clkbench_run
+ * cat /sys/class/clkbench-class/clkbench_results
+ *
+ * For every clock the bench reports the cost of one read (ns/call, min/avg/max
+ * over the online CPUs) and the smallest non-zero step between two consecutive
+ * reads (resolution), so the cheapest adequate clock can be picked per path.
+ */
+
+static unsigned int loops = 100000;
+module_param( loops, uint, 0644 );
+
+/* resolution loop stops after this many clock steps or this much time */
+#define CB_RES_STEPS     16
+#define CB_RES_BUDGET_NS ( 3 * TICK_NSEC )
+
+enum {
+   CB_JIFFIES,
+   CB_KTIME,
+   CB_KTIME_COARSE,
+   CB_KTIME_REAL,
+   CB_LOCAL_CLOCK,
+   CB_SCHED_CLOCK,
+   CB_CYCLES,
+   CB_NR
+};
+
+static const char* const cb_names[ CB_NR ] = {
+   [CB_JIFFIES]      = "jiffies",
+   [CB_KTIME]        = "ktime_get",
+   [CB_KTIME_COARSE] = "ktime_get_coarse",
+   [CB_KTIME_REAL]   = "ktime_get_real",
+   [CB_LOCAL_CLOCK]  = "local_clock",
+   [CB_SCHED_CLOCK]  = "sched_clock",
+   [CB_CYCLES]       = "cycles",
+};
+
+struct cb_result {
+   u64 ps_per_call;     /* picoseconds, keeps three decimals of ns */
+   u64 resolution_ns;   /* 0 when no step was seen within the budget */
+};
+
+static struct cb_result* g_results = NULL;   /* [nr_cpu_ids][CB_NR] */
+static bool g_have_results = false;
+static DEFINE_MUTEX( g_run_lock );
+static u64 g_sink;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,18,0)
+#define cb_ktime_get_coarse() ktime_get_coarse()
+#else
+static inline ktime_t cb_ktime_get_coarse( void )
+{
+   return timespec64_to_ktime( get_monotonic_coarse64() );
+}
+#endif
+
+static inline u64 cb_jiffies_to_ns( u64 delta )
+{
+   return delta * TICK_NSEC;
+}
+
+static inline u64 cb_same_ns( u64 delta )
+{
+   return delta;
+}
+
+static inline u64 cb_cycles_to_ns( u64 delta )
+{
+#ifdef CONFIG_X86
+   if (tsc_khz)
+      return div_u64( delta * 1000000ULL, tsc_khz );
+#endif
+   return delta;
+}
+
+/*
+ * One function per clock so that the read is inlined into the loop and the
+ * measurement is not dominated by an indirect call.
+ */
+#define CB_MEASURE( id, read_expr, to_ns )                                     \
+static void cb_measure_##id( struct cb_result* r )                             \
+{                                                                              \
+   unsigned int i, steps = 0;                                                  \
+   u64 start, end, prev, cur, sink = 0, res = 0;                               \
+                                                                               \
+   preempt_disable();                                                          \
+   start = local_clock();                                                      \
+   for (i = 0; i < loops; i++)                                                 \
+      sink += (u64)( read_expr );                                              \
+   end = local_clock();                                                        \
+   preempt_enable();                                                           \
+   r->ps_per_call = loops ? div_u64( ( end - start ) * 1000, loops ) : 0;      \
+   WRITE_ONCE( g_sink, sink );                                                 \
+                                                                               \
+   start = local_clock();                                                      \
+   prev = (u64)( read_expr );                                                  \
+   for (i = 0; steps < CB_RES_STEPS; i++)                                      \
+   {                                                                           \
+      cur = (u64)( read_expr );                                                \
+      if (cur != prev)                                                         \
+      {                                                                        \
+         if (!res || cur - prev < res)                                         \
+            res = cur - prev;                                                  \
+         prev = cur;                                                           \
+         steps++;                                                              \
+      }                                                                        \
+      if (!( i & 0xff ) && local_clock() - start > CB_RES_BUDGET_NS)           \
+         break;                                                                \
+   }                                                                           \
+   r->resolution_ns = to_ns( res );                                            \
+}
+
+CB_MEASURE( CB_JIFFIES,      get_jiffies_64(),                          cb_jiffies_to_ns )
+CB_MEASURE( CB_KTIME,        ktime_to_ns( ktime_get() ),                cb_same_ns )
+CB_MEASURE( CB_KTIME_COARSE, ktime_to_ns( cb_ktime_get_coarse() ),      cb_same_ns )
+CB_MEASURE( CB_KTIME_REAL,   ktime_to_ns( ktime_get_real() ),           cb_same_ns )
+CB_MEASURE( CB_LOCAL_CLOCK,  local_clock(),                             cb_same_ns )
+CB_MEASURE( CB_SCHED_CLOCK,  sched_clock(),                             cb_same_ns )
+CB_MEASURE( CB_CYCLES,       get_cycles(),                              cb_cycles_to_ns )
+
+/* runs bound to one CPU through work_on_cpu() */
+static long cb_run_cpu( void* arg )
+{
+   struct cb_result* r = arg;
+
+   cb_measure_CB_JIFFIES( &r[ CB_JIFFIES ] );
+   cb_measure_CB_KTIME( &r[ CB_KTIME ] );
+   cb_measure_CB_KTIME_COARSE( &r[ CB_KTIME_COARSE ] );
+   cb_measure_CB_KTIME_REAL( &r[ CB_KTIME_REAL ] );
+   cb_measure_CB_LOCAL_CLOCK( &r[ CB_LOCAL_CLOCK ] );
+   cb_measure_CB_SCHED_CLOCK( &r[ CB_SCHED_CLOCK ] );
+   cb_measure_CB_CYCLES( &r[ CB_CYCLES ] );
+   return 0;
+}
+
+static void cb_run( void )
+{
+   unsigned int cpu;
+
+   memset( g_results, 0, sizeof( *g_results ) * nr_cpu_ids * CB_NR );
+   get_online_cpus();
+   for_each_online_cpu( cpu )
+   {
+      work_on_cpu( cpu, cb_run_cpu, &g_results[ cpu * CB_NR ] );
+      cond_resched();
+   }
+   put_online_cpus();
+   g_have_results = true;
+}
+
+static ssize_t clkbench_run_store( struct class *class, struct class_attribute *attr,
+                                   const char *buf, size_t count ) {
+   mutex_lock( &g_run_lock );
+   cb_run();
+   mutex_unlock( &g_run_lock );
+   return count;
+}
+
+static ssize_t clkbench_results_show( struct class *class, struct class_attribute *attr,
+                                      char *buf ) {
+   ssize_t count = 0;
+   unsigned int cpu, id;
+
+   mutex_lock( &g_run_lock );
+   if (!g_have_results)
+   {
+      count = scnprintf( buf, PAGE_SIZE, "no results, write to clkbench_run first\n" );
+      goto out;
+   }
+   count += scnprintf( buf + count, PAGE_SIZE - count,
+      "%-18s %12s %12s %12s %6s %14s\n",
+      "clock", "min ns/call", "avg ns/call", "max ns/call", "cpu", "resolution ns" );
+   for (id = 0; id < CB_NR; id++)
+   {
+      u64 min = U64_MAX, max = 0, sum = 0, res = 0;
+      unsigned int n = 0, max_cpu = 0;
+
+      for_each_online_cpu( cpu )
+      {
+         struct cb_result* r = &g_results[ cpu * CB_NR + id ];
+         if (r->ps_per_call < min)
+            min = r->ps_per_call;
+         if (r->ps_per_call > max)
+         {
+            max = r->ps_per_call;
+            max_cpu = cpu;
+         }
+         if (r->resolution_ns && ( !res || r->resolution_ns < res ))
+            res = r->resolution_ns;
+         sum += r->ps_per_call;
+         n++;
+      }
+      if (!n)
+         continue;
+      sum = div_u64( sum, n );
+      count += scnprintf( buf + count, PAGE_SIZE - count,
+         "%-18s %8llu.%03llu %8llu.%03llu %8llu.%03llu %6u %14llu\n",
+         cb_names[ id ],
+         div_u64( min, 1000 ), min % 1000,
+         div_u64( sum, 1000 ), sum % 1000,
+         div_u64( max, 1000 ), max % 1000,
+         max_cpu, res );
+   }
+out:
+   mutex_unlock( &g_run_lock );
+   return count;
+}
+
+struct class_attribute class_attr_clkbench_run     = __ATTR_WO( clkbench_run );
+struct class_attribute class_attr_clkbench_results = __ATTR_RO( clkbench_results );
+
+static struct class* clkbench_class;
+
+int __init x_init(void) {
+   int res;
+   g_results = kcalloc( nr_cpu_ids * CB_NR, sizeof( *g_results ), GFP_KERNEL );
+   if (!g_results)
+      return -ENOMEM;
+
+   clkbench_class = class_create( THIS_MODULE, "clkbench-class" );
+   if( IS_ERR( clkbench_class ) ) {
+      printk( "bad class create\n" );
+      kfree( g_results );
+      return PTR_ERR( clkbench_class );
+   }
+   res = class_create_file( clkbench_class, &class_attr_clkbench_run );
+   if (!res)
+      res = class_create_file( clkbench_class, &class_attr_clkbench_results );
+   if (res) {
+      class_remove_file( clkbench_class, &class_attr_clkbench_run );
+      class_destroy( clkbench_class );
+      kfree( g_results );
+   }
+
+   printk( "'clkbench' module initialized %d\n", res );
+   return res;
+}
+
+void x_cleanup(void) {
+   class_remove_file( clkbench_class, &class_attr_clkbench_results );
+   class_remove_file( clkbench_class, &class_attr_clkbench_run );
+   class_destroy( clkbench_class );
+   kfree( g_results );
+   return;
+}
+
+module_init( x_init );
+module_exit( x_cleanup );
+
+MODULE_LICENSE( "GPL" );
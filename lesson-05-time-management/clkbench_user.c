@@ -0,0 +1,221 @@
+/*
+ * User-space counterpart of clkbench.ko: cost and resolution of the
+ * clock_gettime() clocks on every online CPU.
+ *
+ * Every clock is read through the libc wrapper (served by the vDSO when the
+ * clock source allows it) and through a raw syscall, so the difference shows
+ * whether the vDSO fast path is taken on this host.
+ *
+ * usage: clkbench_user [-n loops] [-c cpu]
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/syscall.h>
+
+#define RES_STEPS	16
+#define RES_BUDGET_NS	20000000ULL
+
+enum path { PATH_VDSO, PATH_SYSCALL, PATH_TSC, PATH_GTOD };
+
+struct clk {
+	const char *name;
+	clockid_t id;
+	enum path path;
+};
+
+static const struct clk clocks[] = {
+	{ "REALTIME",		CLOCK_REALTIME,		PATH_VDSO },
+	{ "REALTIME_COARSE",	CLOCK_REALTIME_COARSE,	PATH_VDSO },
+	{ "MONOTONIC",		CLOCK_MONOTONIC,	PATH_VDSO },
+	{ "MONOTONIC_COARSE",	CLOCK_MONOTONIC_COARSE,	PATH_VDSO },
+	{ "MONOTONIC_RAW",	CLOCK_MONOTONIC_RAW,	PATH_VDSO },
+	{ "BOOTTIME",		CLOCK_BOOTTIME,		PATH_VDSO },
+	{ "TAI",		CLOCK_TAI,		PATH_VDSO },
+	{ "REALTIME",		CLOCK_REALTIME,		PATH_SYSCALL },
+	{ "MONOTONIC",		CLOCK_MONOTONIC,	PATH_SYSCALL },
+	{ "gettimeofday",	CLOCK_REALTIME,		PATH_GTOD },
+#if defined(__x86_64__) || defined(__i386__)
+	{ "rdtsc",		CLOCK_MONOTONIC,	PATH_TSC },
+#endif
+};
+
+#define NR_CLOCKS	(sizeof(clocks) / sizeof(clocks[0]))
+
+static const char *path_names[] = {
+	[PATH_VDSO]	= "vdso",
+	[PATH_SYSCALL]	= "syscall",
+	[PATH_TSC]	= "tsc",
+	[PATH_GTOD]	= "vdso",
+};
+
+struct result {
+	double ns_per_call;
+	uint64_t resolution;	/* ns, or cycles for rdtsc */
+};
+
+static volatile uint64_t sink;
+
+static inline uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline uint64_t read_clock(const struct clk *c)
+{
+	struct timespec ts;
+	struct timeval tv;
+
+	switch (c->path) {
+	case PATH_VDSO:
+		clock_gettime(c->id, &ts);
+		break;
+	case PATH_SYSCALL:
+		syscall(SYS_clock_gettime, c->id, &ts);
+		break;
+	case PATH_GTOD:
+		gettimeofday(&tv, NULL);
+		return (uint64_t)tv.tv_sec * 1000000000ULL + tv.tv_usec * 1000ULL;
+	case PATH_TSC:
+#if defined(__x86_64__) || defined(__i386__)
+	{
+		uint32_t lo, hi;
+
+		__asm__ volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+		return ((uint64_t)hi << 32) | lo;
+	}
+#else
+		return 0;
+#endif
+	}
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void measure(const struct clk *c, unsigned long loops, struct result *r)
+{
+	unsigned long i, steps = 0;
+	uint64_t start, end, prev, cur, res = 0, sum = 0;
+
+	start = now_ns();
+	for (i = 0; i < loops; i++)
+		sum += read_clock(c);
+	end = now_ns();
+	sink = sum;
+	r->ns_per_call = (double)(end - start) / loops;
+
+	start = now_ns();
+	prev = read_clock(c);
+	for (i = 0; steps < RES_STEPS; i++) {
+		cur = read_clock(c);
+		if (cur != prev) {
+			if (!res || cur - prev < res)
+				res = cur - prev;
+			prev = cur;
+			steps++;
+		}
+		if (!(i & 0xff) && now_ns() - start > RES_BUDGET_NS)
+			break;
+	}
+	r->resolution = res;
+}
+
+static int pin(int cpu)
+{
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return sched_setaffinity(0, sizeof(set), &set);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long loops = 1000000;
+	int only_cpu = -1, ncpus, cpu, opt, n = 0;
+	struct result *results;
+	cpu_set_t allowed;
+	size_t i;
+
+	while ((opt = getopt(argc, argv, "n:c:")) != -1) {
+		switch (opt) {
+		case 'n':
+			loops = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			only_cpu = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n loops] [-c cpu]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (!loops)
+		loops = 1;
+
+	ncpus = sysconf(_SC_NPROCESSORS_CONF);
+	results = calloc((size_t)ncpus * NR_CLOCKS, sizeof(*results));
+	if (!results) {
+		perror("calloc");
+		return EXIT_FAILURE;
+	}
+	sched_getaffinity(0, sizeof(allowed), &allowed);
+
+	for (cpu = 0; cpu < ncpus; cpu++) {
+		if (only_cpu >= 0 && cpu != only_cpu)
+			continue;
+		if (!CPU_ISSET(cpu, &allowed) || pin(cpu))
+			continue;
+		for (i = 0; i < NR_CLOCKS; i++)
+			measure(&clocks[i], loops, &results[cpu * NR_CLOCKS + i]);
+		n++;
+	}
+	if (!n) {
+		fprintf(stderr, "no usable CPU\n");
+		return EXIT_FAILURE;
+	}
+
+	printf("%-18s %-8s %10s %10s %10s %5s %12s %10s\n", "clock", "path",
+	       "min ns", "avg ns", "max ns", "cpu", "resolution", "getres ns");
+	for (i = 0; i < NR_CLOCKS; i++) {
+		double min = 0, max = 0, sum = 0;
+		uint64_t res = 0;
+		int max_cpu = 0, seen = 0;
+		struct timespec gr = { 0, 0 };
+
+		for (cpu = 0; cpu < ncpus; cpu++) {
+			struct result *r = &results[cpu * NR_CLOCKS + i];
+
+			if (r->ns_per_call == 0)
+				continue;
+			if (!seen || r->ns_per_call < min)
+				min = r->ns_per_call;
+			if (!seen || r->ns_per_call > max) {
+				max = r->ns_per_call;
+				max_cpu = cpu;
+			}
+			if (r->resolution && (!res || r->resolution < res))
+				res = r->resolution;
+			sum += r->ns_per_call;
+			seen++;
+		}
+		if (clocks[i].path != PATH_TSC)
+			clock_getres(clocks[i].id, &gr);
+		printf("%-18s %-8s %10.2f %10.2f %10.2f %5d %10llu%s %10ld\n",
+		       clocks[i].name, path_names[clocks[i].path],
+		       min, seen ? sum / seen : 0, max, max_cpu,
+		       (unsigned long long)res,
+		       clocks[i].path == PATH_TSC ? "cy" : "ns",
+		       gr.tv_sec * 1000000000L + gr.tv_nsec);
+	}
+	free(results);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,152 @@
+/*
+ * Reader of /proc/xxxtm_samples (xxxtm.ko): reads records in bulk for a
+ * while and prints, per CPU, the number of samples, the samples dropped on
+ * a full ring and the interval between consecutive samples (min, average,
+ * max, standard deviation).
+ *
+ * With sample_ns=N the intervals are the hrtimer period plus its jitter;
+ * with sample_ns=0 every read is a burst of back-to-back ktime_get_ns()
+ * calls, and the intervals are the cost and step of the clock itself.
+ *
+ * usage: tmsample [-t seconds] [-o raw output file]
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <math.h>
+#include <time.h>
+#include "xxxtm_sample.h"
+
+#define PROC_PATH	"/proc/xxxtm_samples"
+#define BATCH		65536
+#define MAX_CPUS	4096
+
+struct cpu_stat {
+	unsigned long long samples, dropped, intervals;
+	unsigned long long min, max;
+	double sum, sum2;
+	__u64 last_ns;
+	__u32 last_seq;
+	int seen;
+};
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void account(struct cpu_stat *st, const struct xxxtm_sample *rec)
+{
+	st->samples++;
+	/* a lower seq is a new burst, not a step back in time */
+	if (st->seen && rec->seq > st->last_seq) {
+		unsigned long long d = rec->ns - st->last_ns;
+
+		st->dropped += rec->seq - st->last_seq - 1;
+		if (rec->seq == st->last_seq + 1) {
+			if (!st->intervals || d < st->min)
+				st->min = d;
+			if (d > st->max)
+				st->max = d;
+			st->sum += d;
+			st->sum2 += (double)d * d;
+			st->intervals++;
+		}
+	}
+	st->last_ns = rec->ns;
+	st->last_seq = rec->seq;
+	st->seen = 1;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *out_path = NULL;
+	unsigned int seconds = 1;
+	struct xxxtm_sample *recs;
+	struct cpu_stat *stats;
+	FILE *out = NULL;
+	double end;
+	ssize_t n, i;
+	int fd, opt, cpu;
+
+	while ((opt = getopt(argc, argv, "t:o:")) != -1) {
+		switch (opt) {
+		case 't':
+			seconds = strtoul(optarg, NULL, 0);
+			break;
+		case 'o':
+			out_path = optarg;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-t seconds] [-o raw output file]\n",
+				argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	recs = malloc(BATCH * sizeof(*recs));
+	stats = calloc(MAX_CPUS, sizeof(*stats));
+	if (!recs || !stats) {
+		perror("malloc");
+		return EXIT_FAILURE;
+	}
+	fd = open(PROC_PATH, O_RDONLY);
+	if (fd < 0) {
+		perror(PROC_PATH);
+		return EXIT_FAILURE;
+	}
+	if (out_path) {
+		out = fopen(out_path, "w");
+		if (!out) {
+			perror(out_path);
+			return EXIT_FAILURE;
+		}
+	}
+
+	end = now_s() + seconds;
+	do {
+		n = read(fd, recs, BATCH * sizeof(*recs));
+		if (n < 0) {
+			perror("read");
+			return EXIT_FAILURE;
+		}
+		n /= sizeof(*recs);
+		if (out && fwrite(recs, sizeof(*recs), n, out) != (size_t)n) {
+			perror(out_path);
+			return EXIT_FAILURE;
+		}
+		for (i = 0; i < n; i++)
+			if (recs[i].cpu < MAX_CPUS)
+				account(&stats[recs[i].cpu], &recs[i]);
+		/* timer mode: let the rings fill instead of spinning on them */
+		if (!n)
+			usleep(1000);
+	} while (now_s() < end);
+
+	printf("%4s %12s %10s %10s %12s %12s %10s\n", "cpu", "samples", "dropped",
+	       "min ns", "avg ns", "max ns", "stddev");
+	for (cpu = 0; cpu < MAX_CPUS; cpu++) {
+		struct cpu_stat *st = &stats[cpu];
+		double avg, var;
+
+		if (!st->samples)
+			continue;
+		avg = st->intervals ? st->sum / st->intervals : 0;
+		var = st->intervals ? st->sum2 / st->intervals - avg * avg : 0;
+		printf("%4d %12llu %10llu %10llu %12.1f %12llu %10.1f\n", cpu,
+		       st->samples, st->dropped, st->min, avg, st->max,
+		       var > 0 ? sqrt(var) : 0);
+	}
+	if (out)
+		fclose(out);
+	close(fd);
+	free(recs);
+	free(stats);
+	return EXIT_SUCCESS;
+}
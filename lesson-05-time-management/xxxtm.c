@@ -7,6 +7,21 @@
 #include <linux/init.h>
 #include <linux/sched.h>
 #include <linux/time.h>
+#include <linux/moduleparam.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/percpu.h>
+#include <linux/proc_fs.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/log2.h>
+#include "xxxtm_sample.h"
+
+#define CREATE_TRACE_POINTS
+#include "xxxtm_trace.h"
+#include <xevent.h>
+
+#include <dbgkey.h>
 
 static u64 g_last_sys_time = 0;
 static struct timeval g_last_abs_time = { 0, 0 };
@@ -14,16 +29,18 @@ static struct timeval g_last_abs_time = { 0, 0 };
 static ssize_t tm_jif_show( struct class *class, struct class_attribute *attr, char *buf ) {
    size_t count = 0;
    u64 sys_time = get_jiffies_64();
+   u64 diff = 0;
    unsigned int seconds = 0;
    if (g_last_sys_time)
    {
-      u64 diff = sys_time - g_last_sys_time;
+      diff = sys_time - g_last_sys_time;
       seconds = jiffies_to_msecs( diff ) / MSEC_PER_SEC;
    }
    sprintf( buf, "Time elapsed since last read: %u seconds\n", seconds );
    count = strlen( buf );
    g_last_sys_time = sys_time;
-   printk( "read %ld\n", (long)count );
+   trace_tm_jif_show( diff, seconds );
+   DBG( "read %ld\n", (long)count );
    return count;
 }
 
@@ -31,22 +48,253 @@ static ssize_t tm_absk_show( struct class *class, struct class_attribute *attr,
    size_t count = 0;
    struct timeval tv = { 0, 0 };
    struct timeval tv_diff = { 0, 0 };
+   s64 diff = 0;
    do_gettimeofday( &tv );
    if (g_last_abs_time.tv_sec)
    {
       s64 ns_current = timeval_to_ns( &tv );
       s64 ns_last    = timeval_to_ns( &g_last_abs_time );
-      s64 diff = ns_current - ns_last;
+      diff = ns_current - ns_last;
       tv_diff = ns_to_timeval( diff );
    }
    sprintf( buf, "Time elapsed since last read: %llu.%u seconds \n",
       (long long)tv_diff.tv_sec, (unsigned)tv_diff.tv_usec );
    count = strlen( buf );
    g_last_abs_time = tv;
-   printk( "read %ld\n", (long)count );
+   trace_tm_absk_show( diff );
+   DBG( "read %ld\n", (long)count );
    return count;
 }
 
+/*
+ * Sampling mode, records of xxxtm_sample.h read in bulk from
+ * /proc/xxxtm_samples:
+ *
+ * sample_ns=N - a pinned hrtimer on every online CPU stores ktime_get_ns()
+ *    every N ns (TM_SAMPLE_MIN_NS at least) into a ring of sample_buf
+ *    records of its own; a read drains the rings, CPU after CPU. The timer
+ *    is the only producer of a ring and readers take g_sample_lock, so the
+ *    rings need no lock. Changing sample_ns drops what was not read.
+ * sample_ns=0 - a read takes back-to-back samples on the reader's CPU, up
+ *    to TM_BURST of them, as many as fit the buffer.
+ *
+ * 'insmod xxxtm.ko sample_ns=N' only records N, the timers start at the end
+ * of x_init() once nothing there can fail.
+ */
+#define TM_SAMPLE_MIN_NS   1000
+#define TM_BURST           4096
+
+struct tm_cpu
+{
+   struct hrtimer timer;
+   struct xxxtm_sample* ring;
+   u32 head;            /* next slot of the timer */
+   u32 tail;            /* next slot of the reader */
+   u32 seq;
+};
+
+static DEFINE_PER_CPU( struct tm_cpu, g_tm_cpu );
+static DEFINE_MUTEX( g_sample_lock );
+static unsigned long g_sample_ns = 0;
+static unsigned int g_sample_buf = 16384;
+static unsigned int g_next_cpu = 0;
+static bool g_sample_ready = false;   /* sample_ns may start the timers */
+module_param_named( sample_buf, g_sample_buf, uint, 0444 );
+
+static enum hrtimer_restart tm_sample_tick( struct hrtimer* timer )
+{
+   struct tm_cpu* c = container_of( timer, struct tm_cpu, timer );
+   u32 head = c->head;
+   u32 seq = c->seq++;
+
+   /* full: the sample is dropped, the gap shows in seq */
+   if (head - smp_load_acquire( &c->tail ) < g_sample_buf)
+   {
+      struct xxxtm_sample* rec = &c->ring[ head & (g_sample_buf - 1) ];
+      rec->ns = ktime_get_ns();
+      rec->cpu = smp_processor_id();
+      rec->seq = seq;
+      smp_store_release( &c->head, head + 1 );
+   }
+   hrtimer_forward_now( timer, ns_to_ktime( g_sample_ns ) );
+   return HRTIMER_RESTART;
+}
+
+/* on every online CPU, so the timer is pinned there */
+static void tm_sample_arm( void* unused )
+{
+   struct tm_cpu* c = this_cpu_ptr( &g_tm_cpu );
+
+   if (!c->ring)
+      return;
+   hrtimer_init( &c->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL_PINNED );
+   c->timer.function = tm_sample_tick;
+   hrtimer_start( &c->timer, ns_to_ktime( g_sample_ns ), HRTIMER_MODE_REL_PINNED );
+}
+
+/* g_sample_lock held */
+static void tm_sample_stop( void )
+{
+   int cpu;
+
+   for_each_possible_cpu( cpu )
+   {
+      struct tm_cpu* c = per_cpu_ptr( &g_tm_cpu, cpu );
+      if (!c->ring)
+         continue;
+      /* a CPU that came up after tm_sample_arm() has no timer running */
+      if (c->timer.function)
+         hrtimer_cancel( &c->timer );
+      kvfree( c->ring );
+      memset( c, 0, sizeof( *c ) );
+   }
+}
+
+/* g_sample_lock held */
+static int tm_sample_start( void )
+{
+   int cpu;
+
+   for_each_online_cpu( cpu )
+   {
+      struct tm_cpu* c = per_cpu_ptr( &g_tm_cpu, cpu );
+      c->ring = kvmalloc_node( g_sample_buf * sizeof( *c->ring ), GFP_KERNEL,
+                               cpu_to_node( cpu ) );
+      if (!c->ring)
+      {
+         tm_sample_stop();
+         return -ENOMEM;
+      }
+   }
+   on_each_cpu( tm_sample_arm, NULL, 1 );
+   return 0;
+}
+
+static int sample_ns_set( const char* val, const struct kernel_param* kp )
+{
+   unsigned long ns;
+   int res = kstrtoul( val, 0, &ns );
+   if (res)
+      return res;
+   if (ns && ns < TM_SAMPLE_MIN_NS)
+      return -EINVAL;
+
+   mutex_lock( &g_sample_lock );
+   tm_sample_stop();
+   g_sample_ns = ns;
+   if (ns && g_sample_ready)
+      res = tm_sample_start();
+   if (res)
+      g_sample_ns = 0;
+   mutex_unlock( &g_sample_lock );
+   return res;
+}
+
+/* no sample_ns store starts the timers again */
+static void tm_sample_shutdown( void )
+{
+   mutex_lock( &g_sample_lock );
+   g_sample_ready = false;
+   tm_sample_stop();
+   mutex_unlock( &g_sample_lock );
+}
+
+static const struct kernel_param_ops sample_ns_ops = {
+   .set = sample_ns_set,
+   .get = param_get_ulong,
+};
+module_param_cb( sample_ns, &sample_ns_ops, &g_sample_ns, 0644 );
+
+/* up to 'n' records of one ring, returns the number copied */
+static ssize_t tm_drain_cpu( struct tm_cpu* c, char __user* buf, size_t n )
+{
+   u32 tail = c->tail;
+   u32 head = smp_load_acquire( &c->head );
+   size_t done = 0;
+
+   while (done < n && tail != head)
+   {
+      u32 idx = tail & (g_sample_buf - 1);
+      size_t chunk = min3( (size_t)(head - tail), (size_t)(g_sample_buf - idx),
+                           n - done );
+      if (copy_to_user( buf + done * sizeof( *c->ring ), &c->ring[ idx ],
+                        chunk * sizeof( *c->ring ) ))
+         break;
+      tail += chunk;
+      done += chunk;
+   }
+   smp_store_release( &c->tail, tail );
+   return done ? done : (tail != head ? -EFAULT : 0);
+}
+
+static ssize_t tm_drain( char __user* buf, size_t n )
+{
+   unsigned int i, cpu = g_next_cpu;
+   size_t done = 0;
+
+   /* a different first CPU every read, so a small buffer starves no one */
+   for (i = 0; i < nr_cpu_ids && done < n; i++, cpu = (cpu + 1) % nr_cpu_ids)
+   {
+      struct tm_cpu* c = per_cpu_ptr( &g_tm_cpu, cpu );
+      ssize_t res;
+      if (!cpu_possible( cpu ) || !c->ring)
+         continue;
+      res = tm_drain_cpu( c, buf + done * sizeof( struct xxxtm_sample ), n - done );
+      if (res < 0)
+         return done ? done : res;
+      done += res;
+   }
+   g_next_cpu = (g_next_cpu + 1) % nr_cpu_ids;
+   return done;
+}
+
+static ssize_t tm_burst( char __user* buf, size_t n )
+{
+   struct xxxtm_sample* recs;
+   unsigned int cpu;
+   size_t i;
+   ssize_t res;
+
+   n = min_t( size_t, n, TM_BURST );
+   recs = kvmalloc( n * sizeof( *recs ), GFP_KERNEL );
+   if (!recs)
+      return -ENOMEM;
+   cpu = get_cpu();
+   for (i = 0; i < n; i++)
+      recs[ i ].ns = ktime_get_ns();
+   put_cpu();
+   for (i = 0; i < n; i++)
+   {
+      recs[ i ].cpu = cpu;
+      recs[ i ].seq = i;
+   }
+   res = copy_to_user( buf, recs, n * sizeof( *recs ) ) ? -EFAULT : n;
+   kvfree( recs );
+   return res;
+}
+
+static ssize_t samples_read( struct file* file_p, char __user* buf, size_t length,
+                             loff_t* offset )
+{
+   size_t n = length / sizeof( struct xxxtm_sample );
+   ssize_t res;
+
+   if (!n)
+      return -EINVAL;
+   if (mutex_lock_interruptible( &g_sample_lock ))
+      return -ERESTARTSYS;
+   res = g_sample_ns ? tm_drain( buf, n ) : tm_burst( buf, n );
+   mutex_unlock( &g_sample_lock );
+   return res < 0 ? res : res * sizeof( struct xxxtm_sample );
+}
+
+static const struct file_operations samples_fops = {
+   .owner = THIS_MODULE,
+   .read  = samples_read,
+};
+
+static struct proc_dir_entry* g_samples_entry;
+
 //CLASS_ATTR_RO( xxxtm );
 struct class_attribute class_attr_tm_jif  = __ATTR_RO( tm_jif );
 struct class_attribute class_attr_tm_absk = __ATTR_RO( tm_absk );
@@ -54,26 +302,137 @@ struct class_attribute class_attr_tm_absk = __ATTR_RO( tm_absk );
 static struct class* tm_jif_class;
 static struct class* tm_absk_class;
 
+/*
+ * xevents=1: the trace events also go to the relay channel of <xevent.h>,
+ * /sys/kernel/debug/xevent_xxxtm/cpuN, xevent_buf_kb per CPU.
+ */
+static bool g_xevents = false;
+module_param_named( xevents, g_xevents, bool, 0444 );
+static unsigned int g_xevent_buf_kb = 256;
+module_param_named( xevent_buf_kb, g_xevent_buf_kb, uint, 0444 );
+
+static void xev_jif( void* data, u64 jiffies_diff, unsigned int seconds )
+{
+   xevent_emit( XEVENT_TM_JIF, jiffies_diff, seconds );
+}
+
+static void xev_absk( void* data, s64 ns_diff )
+{
+   xevent_emit( XEVENT_TM_ABSK, ns_diff, 0 );
+}
+
+/* probes xevents_start() registered, the only ones to unregister */
+static unsigned int g_xev_probes = 0;
+
+static void xevents_stop( void )
+{
+   if (!xevent_chan)
+      return;
+   if (g_xev_probes > 1)
+      unregister_trace_tm_absk_show( xev_absk, NULL );
+   if (g_xev_probes > 0)
+      unregister_trace_tm_jif_show( xev_jif, NULL );
+   g_xev_probes = 0;
+   tracepoint_synchronize_unregister();
+   xevent_close();
+}
+
+static void xevents_start( void )
+{
+   int res;
+
+   if (!g_xevents)
+      return;
+   res = xevent_open( "xevent_" KBUILD_MODNAME, g_xevent_buf_kb );
+   if (!res && !(res = register_trace_tm_jif_show( xev_jif, NULL )))
+      g_xev_probes++;
+   if (!res && !(res = register_trace_tm_absk_show( xev_absk, NULL )))
+      g_xev_probes++;
+   if (res)
+   {
+      printk( "%s: no event channel: %d\n", THIS_MODULE->name, res );
+      xevents_stop();
+   }
+}
+
 int __init x_init(void) {
    int res;
+
+   /* sample_buf is fixed at load time */
+   g_sample_buf = roundup_pow_of_two( clamp( g_sample_buf, 64U, 1U << 20 ) );
+
    tm_jif_class = class_create( THIS_MODULE, "tm_jif-class" );
-   if( IS_ERR( tm_jif_class ) ) printk( "bad class create\n" );
+   if (IS_ERR( tm_jif_class ))
+   {
+      printk( "bad class create\n" );
+      res = PTR_ERR( tm_jif_class );
+      goto error;
+   }
    res = class_create_file( tm_jif_class, &class_attr_tm_jif );
+   if (res)
+      goto error_jif_class;
 
    tm_absk_class = class_create( THIS_MODULE, "tm_absk-class" );
-   if( IS_ERR( tm_absk_class ) ) printk( "bad class create\n" );
-   res |= class_create_file( tm_absk_class, &class_attr_tm_absk );
+   if (IS_ERR( tm_absk_class ))
+   {
+      printk( "bad class create\n" );
+      res = PTR_ERR( tm_absk_class );
+      goto error_jif_file;
+   }
+   res = class_create_file( tm_absk_class, &class_attr_tm_absk );
+   if (res)
+      goto error_absk_class;
+
+   g_samples_entry = proc_create( "xxxtm_samples", S_IFREG | S_IRUGO, NULL,
+                                  &samples_fops );
+   if (!g_samples_entry)
+   {
+      res = -ENOMEM;
+      goto error_absk_file;
+   }
+   xevents_start();
+
+   /* a sample_ns given to insmod was only recorded */
+   mutex_lock( &g_sample_lock );
+   g_sample_ready = true;
+   if (g_sample_ns)
+      res = tm_sample_start();
+   if (res)
+      g_sample_ns = 0;
+   mutex_unlock( &g_sample_lock );
+   if (res)
+      goto error_samples;
+
+   printk( "'xxxtm' module initialized %d\n", res );
+   return 0;
 
+error_samples:
+   tm_sample_shutdown();
+   xevents_stop();
+   proc_remove( g_samples_entry );
+error_absk_file:
+   class_remove_file( tm_absk_class, &class_attr_tm_absk );
+error_absk_class:
+   class_destroy( tm_absk_class );
+error_jif_file:
+   class_remove_file( tm_jif_class, &class_attr_tm_jif );
+error_jif_class:
+   class_destroy( tm_jif_class );
+error:
    printk( "'xxxtm' module initialized %d\n", res );
    return res;
 }
 
 void x_cleanup(void) {
+   proc_remove( g_samples_entry );
+   tm_sample_shutdown();
+
    class_remove_file( tm_absk_class, &class_attr_tm_absk );
    class_destroy( tm_absk_class );
 
    class_remove_file( tm_jif_class, &class_attr_tm_jif );
    class_destroy( tm_jif_class );
+   xevents_stop();
    return;
 }
 
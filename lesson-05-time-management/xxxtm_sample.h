@@ -0,0 +1,20 @@
+#ifndef XXXTM_SAMPLE_H
+#define XXXTM_SAMPLE_H
+
+#include <linux/types.h>
+
+/*
+ * /proc/xxxtm_samples - packed array of struct xxxtm_sample, a read returns
+ * whole records only (see the sample_ns parameter of xxxtm).
+ *
+ * seq counts every sample a CPU took, stored or not: a gap between two
+ * records of one CPU is the number of samples dropped on a full ring.
+ */
+struct xxxtm_sample
+{
+   __u64 ns;            /* ktime_get_ns() */
+   __u32 cpu;
+   __u32 seq;
+};
+
+#endif /* XXXTM_SAMPLE_H */
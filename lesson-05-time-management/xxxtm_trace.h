@@ -0,0 +1,41 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM xxxtm
+
+#if !defined( _XXXTM_TRACE_H ) || defined( TRACE_HEADER_MULTI_READ )
+#define _XXXTM_TRACE_H
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT( tm_jif_show,
+   TP_PROTO( u64 jiffies_diff, unsigned int seconds ),
+   TP_ARGS( jiffies_diff, seconds ),
+   TP_STRUCT__entry(
+      __field( u64, jiffies_diff )
+      __field( unsigned int, seconds )
+   ),
+   TP_fast_assign(
+      __entry->jiffies_diff = jiffies_diff;
+      __entry->seconds      = seconds;
+   ),
+   TP_printk( "%llu jiffies, %u seconds", __entry->jiffies_diff, __entry->seconds )
+);
+
+TRACE_EVENT( tm_absk_show,
+   TP_PROTO( s64 ns_diff ),
+   TP_ARGS( ns_diff ),
+   TP_STRUCT__entry(
+      __field( s64, ns_diff )
+   ),
+   TP_fast_assign(
+      __entry->ns_diff = ns_diff;
+   ),
+   TP_printk( "%lld ns", __entry->ns_diff )
+);
+
+#endif /* _XXXTM_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE xxxtm_trace
+#include <trace/define_trace.h>
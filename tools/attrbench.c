@@ -0,0 +1,95 @@
+/*
+ * Hammer one sysfs/procfs file and report ops/s, e.g. to compare a module
+ * with per-call printk against its trace-event build:
+ *
+ *   attrbench -n 1000000 /sys/class/x-class/xxx
+ *   attrbench -w hello -n 1000000 /sys/class/x-class/xxx
+ *
+ * Reads and writes use pread/pwrite at offset 0 on one descriptor; -o
+ * reopens the file for every operation, like `cat`/`echo` would.
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long ops = 100000, i, errors = 0;
+	const char *msg = NULL, *path;
+	int reopen = 0, opt, fd = -1;
+	char buf[4096];
+	size_t len = 0;
+	double start, elapsed;
+	ssize_t res;
+
+	while ((opt = getopt(argc, argv, "n:w:o")) != -1) {
+		switch (opt) {
+		case 'n':
+			ops = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			msg = optarg;
+			len = strlen(msg);
+			break;
+		case 'o':
+			reopen = 1;
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (optind != argc - 1)
+		goto usage;
+	path = argv[optind];
+
+	if (!reopen) {
+		fd = open(path, msg ? O_WRONLY : O_RDONLY);
+		if (fd < 0) {
+			printf("open %s error: %m\n", path);
+			return EXIT_FAILURE;
+		}
+	}
+
+	start = now_s();
+	for (i = 0; i < ops; i++) {
+		if (reopen) {
+			fd = open(path, msg ? O_WRONLY : O_RDONLY);
+			if (fd < 0) {
+				errors++;
+				continue;
+			}
+		}
+		if (msg)
+			res = pwrite(fd, msg, len, 0);
+		else
+			res = pread(fd, buf, sizeof(buf), 0);
+		if (res < 0)
+			errors++;
+		if (reopen)
+			close(fd);
+	}
+	elapsed = now_s() - start;
+	if (!reopen)
+		close(fd);
+
+	printf("%s %s: %lu ops in %.3f s, %.0f ops/s, %.0f ns/op, %lu errors\n",
+	       path, msg ? "write" : "read", ops, elapsed,
+	       ops / elapsed, elapsed * 1e9 / ops, errors);
+	return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+
+usage:
+	fprintf(stderr, "usage: %s [-n ops] [-w message] [-o] file\n", argv[0]);
+	return EXIT_FAILURE;
+}
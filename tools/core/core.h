@@ -0,0 +1,59 @@
+/*
+ * User space entry points into the module core files, see kshim.h.
+ * Not thread safe: call from one thread at a time.
+ */
+#ifndef CORE_H
+#define CORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define CORE_PAGE_SIZE	4096
+
+extern int kshim_user_fault;
+extern int kshim_verbose;
+
+/* lesson-04-memory-management/mm/xxx_msg.c */
+/*
+ * shards: sysfs stores go to the shard of the CPU set by xxx_core_set_cpu()
+ * cache_prefill: the xxx_cache reserve of mem_config 1, 0 for none
+ * lz4_cache_kb: budget of decompressed copies in mem_config 2, 0 for none
+ */
+int xxx_core_init(int mem_config, unsigned int lz4_threshold, int shards,
+		  unsigned int cache_prefill, unsigned int lz4_cache_kb);
+void xxx_core_exit(void);
+size_t xxx_core_store(const char *buf, size_t count);	/* sysfs write */
+size_t xxx_core_show(char *page);			/* sysfs read */
+ssize_t xxx_core_read(char *buf, size_t count, long long *pos);
+ssize_t xxx_core_write(const char *buf, size_t count, long long *pos);
+long xxx_core_truncate(uint64_t len);
+size_t xxx_core_len(void);
+int xxx_core_packed(void);
+void xxx_core_run_work(void);		/* pending LZ4 pack, cache drop */
+void xxx_core_set_cpu(int cpu);
+
+/* lesson-03-modules-interfaces/examples.245.proc/fops_rw.c */
+ssize_t node_core_read(char *buf, size_t count, long long *pos);
+ssize_t node_core_write(const char *buf, size_t count);
+
+/* lesson-03-modules-interfaces/procfs_rw/rw_buf.c */
+/*
+ * zerocopy_min 0: copy only, log_size 0: one message, else log mode,
+ * defer_ms 0: write through, else writes are staged until rw_core_flush()
+ * or a full stage. rw_core_set_cpu() picks the stage of the next writes.
+ */
+int rw_core_init(unsigned long zerocopy_min, unsigned int log_size,
+		 unsigned int defer_ms);
+void rw_core_exit(void);
+int rw_core_read(char *buf, size_t count);
+int rw_core_write(const char *buf, size_t count);
+void *rw_core_log_open(void);
+void rw_core_log_close(void *reader);
+ssize_t rw_core_log_read(void *reader, char *buf, size_t count);
+int rw_core_log_pending(void *reader);
+unsigned long long rw_core_log_seq(void *reader);
+void rw_core_flush(void);
+void rw_core_set_cpu(int cpu);
+
+#endif /* CORE_H */
@@ -0,0 +1,216 @@
+/*
+ * Microbenchmark of the module core logic in user space (see kshim.h):
+ * xxx store/show and /dev/xxx read/write per mem_config, mod_node
+ * read/write and procfs_rw read/write. Numbers are ns per call.
+ *
+ * usage: corebench [-n loops] [-m mem_config] [-v]
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "core.h"
+
+static const size_t sizes[] = { 16, 160, 4000, 65536 };
+
+#define NR_SIZES	(sizeof(sizes) / sizeof(sizes[0]))
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void report(const char *what, size_t size, double t, unsigned long n)
+{
+	double ns = (now_ns() - t) / n;
+
+	printf("%-26s %8zu %10.1f %10.1f\n", what, size, ns,
+	       ns > 0 ? size / ns * 1e3 : 0);
+}
+
+static void bench_xxx(int mem_config, unsigned long loops, char *msg,
+		      char *buf)
+{
+	static const char *names[] = { "kmalloc", "kmcache", "lz4" };
+	char what[32];
+	unsigned long i;
+	size_t s, bytes;
+	double t;
+
+	if (xxx_core_init(mem_config, 4096, 0, 0, 0)) {
+		fprintf(stderr, "mem_config=%d: init failed\n", mem_config);
+		return;
+	}
+	/* the bytes column is what a call really moved (kmcache keeps 160) */
+	for (s = 0; s < NR_SIZES; s++) {
+		size_t size = sizes[s];
+		unsigned long n = size > 4096 ? loops / 16 + 1 : loops;
+		long long pos;
+
+		snprintf(what, sizeof(what), "xxx %s store", names[mem_config]);
+		t = now_ns();
+		for (i = 0, bytes = 0; i < n; i++)
+			bytes += xxx_core_store(msg, size);
+		report(what, bytes / n, t, n);
+
+		snprintf(what, sizeof(what), "xxx %s show", names[mem_config]);
+		t = now_ns();
+		for (i = 0, bytes = 0; i < n; i++)
+			bytes += xxx_core_show(buf);
+		report(what, bytes / n, t, n);
+
+		snprintf(what, sizeof(what), "xxx %s write", names[mem_config]);
+		t = now_ns();
+		for (i = 0; i < n; i++) {
+			pos = 0;
+			xxx_core_write(msg, size, &pos);
+		}
+		report(what, pos, t, n);
+
+		/* append in 4 KiB steps up to 'size', like cat > /dev/xxx */
+		snprintf(what, sizeof(what), "xxx %s append", names[mem_config]);
+		t = now_ns();
+		for (i = 0; i < n; i++) {
+			size_t step = size < 4096 ? size : 4096;
+
+			xxx_core_truncate(0);
+			for (pos = 0; pos < (long long)size; )
+				if (xxx_core_write(msg, step, &pos) <= 0)
+					break;
+		}
+		report(what, pos, t, n);
+
+		xxx_core_run_work();
+		snprintf(what, sizeof(what), "xxx %s read%s", names[mem_config],
+			 xxx_core_packed() ? " (packed)" : "");
+		t = now_ns();
+		for (i = 0; i < n; i++) {
+			pos = 0;
+			xxx_core_read(buf, size, &pos);
+		}
+		report(what, pos, t, n);
+	}
+	xxx_core_exit();
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long loops = 200000, i;
+	int only = -1, opt, m;
+	size_t max = sizes[NR_SIZES - 1];
+	char *msg, *buf;
+	void *reader;
+	long long pos;
+	double t;
+
+	while ((opt = getopt(argc, argv, "n:m:v")) != -1) {
+		switch (opt) {
+		case 'n':
+			loops = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			only = atoi(optarg);
+			break;
+		case 'v':
+			kshim_verbose = 1;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n loops] [-m mem_config] [-v]\n",
+				argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (!loops)
+		loops = 1;
+
+	msg = malloc(max);
+	buf = malloc(max > CORE_PAGE_SIZE ? max : CORE_PAGE_SIZE);
+	if (!msg || !buf) {
+		perror("malloc");
+		return EXIT_FAILURE;
+	}
+	for (i = 0; i < max; i++)
+		msg[i] = 'a' + (i / 7) % 26;
+
+	printf("%-26s %8s %10s %10s\n", "op", "bytes", "ns", "MB/s");
+	for (m = 0; m < 3; m++)
+		if (only < 0 || only == m)
+			bench_xxx(m, loops, msg, buf);
+
+	t = now_ns();
+	for (i = 0; i < loops; i++)
+		node_core_write(msg, 50);
+	report("mod_node write", 50, t, loops);
+	t = now_ns();
+	for (i = 0; i < loops; i++) {
+		pos = 0;
+		node_core_read(buf, 160, &pos);
+	}
+	report("mod_node read", 50, t, loops);
+
+	if (rw_core_init(0, 0, 0)) {
+		fprintf(stderr, "procfs_rw: init failed\n");
+		return EXIT_FAILURE;
+	}
+	t = now_ns();
+	for (i = 0; i < loops; i++)
+		rw_core_write(msg, 10);
+	report("procfs_rw write", 10, t, loops);
+	t = now_ns();
+	for (i = 0; i < loops; i++) {
+		rw_core_write(msg, 10);
+		rw_core_read(buf, 10);
+	}
+	report("procfs_rw write+read", 10, t, loops);
+	rw_core_exit();
+
+	/* deferred: bursts of 64 overwrites, one flush publishes the last */
+	if (rw_core_init(0, 0, 1)) {
+		fprintf(stderr, "procfs_rw: init failed\n");
+		return EXIT_FAILURE;
+	}
+	t = now_ns();
+	for (i = 0; i < loops; i++) {
+		rw_core_write(msg, 10);
+		if (i % 64 == 63)
+			rw_core_flush();
+	}
+	rw_core_flush();
+	report("procfs_rw deferred write", 10, t, loops);
+	rw_core_exit();
+
+	/* pinned writes, read back in one go */
+	if (rw_core_init(4096, 0, 0)) {
+		fprintf(stderr, "procfs_rw: init failed\n");
+		return EXIT_FAILURE;
+	}
+	t = now_ns();
+	for (i = 0; i < loops / 16 + 1; i++) {
+		rw_core_write(msg, max);
+		rw_core_read(buf, max);
+	}
+	report("procfs_rw zc write+read", max, t, loops / 16 + 1);
+	rw_core_exit();
+
+	/* log mode: one writer, one reader keeping up */
+	if (rw_core_init(0, 1 << 20, 0) || !(reader = rw_core_log_open())) {
+		fprintf(stderr, "procfs_rw: init failed\n");
+		return EXIT_FAILURE;
+	}
+	t = now_ns();
+	for (i = 0; i < loops; i++) {
+		rw_core_write(msg, 100);
+		rw_core_log_read(reader, buf, 100);
+	}
+	report("procfs_rw log write+read", 100, t, loops);
+	rw_core_log_close(reader);
+	rw_core_exit();
+
+	free(msg);
+	free(buf);
+	return EXIT_SUCCESS;
+}
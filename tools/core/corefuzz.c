@@ -0,0 +1,488 @@
+/*
+ * Fuzz target for the module core logic (see kshim.h). The input is a
+ * script of operations on xxx (sysfs store/show, sharded per CPU or not,
+ * /dev/xxx read/write, truncate, LZ4 pack), mod_node and procfs_rw (message, log, deferred
+ * writes staged on one of several CPUs). Every result is checked
+ * against a plain model of what the message should be, so besides memory
+ * errors a wrong length or content aborts.
+ *
+ * Build with 'make fuzz' (clang, libFuzzer) and run ./corefuzz corpus/;
+ * corefuzz_run has its own main(): it replays the files given, or runs
+ * -n random scripts without any fuzzer.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "core.h"
+
+#define NODE_LEN	160	/* LEN_MSG of examples.245.proc */
+#define RW_LEN		10	/* BUFFER_SIZE of procfs_rw */
+#define RW_ZEROCOPY	64	/* zerocopy_min when the input enables it */
+#define RW_LOG_SIZE	4096	/* smallest log, overruns come quickly */
+#define RW_LOG_REC	1024	/* LOG_REC_MAX */
+#define RW_STAGE_SIZE	4096	/* STAGE_SIZE */
+#define RW_STAGE_REC	16	/* sizeof(struct stage_rec) */
+#define RW_CPUS		4	/* KSHIM_NR_CPUS */
+#define MAX_MSG		(1 << 20)
+
+enum {
+	OP_STORE, OP_SHOW, OP_WRITE, OP_READ, OP_TRUNCATE, OP_PACK, OP_FAULT,
+	OP_NODE_WRITE, OP_NODE_READ, OP_RW_WRITE, OP_RW_READ, OP_RW_FLUSH,
+	NR_OPS
+};
+
+struct model {
+	char *msg;
+	size_t len;
+	int shards;
+	char node[NODE_LEN + 1];
+	int node_known;
+	char rw[1 << 16];
+	size_t rw_len, rw_pos, rw_zerocopy;
+	/* log mode: every record written, by sequence number */
+	int log;
+	void *readers[2];
+	size_t *rec_off, *rec_len, nr_recs;
+	char *arena;
+	size_t arena_len;
+	/* deferred writes: what the next flush publishes */
+	int defer;
+	char pend[RW_LEN];
+	size_t pend_len;
+	int pend_set;
+	size_t *pend_rec, nr_pend;	/* log mode: lengths, data in pend_arena */
+	char *pend_arena;
+	size_t pend_arena_len;
+	size_t stage_used[RW_CPUS];
+};
+
+static char page[CORE_PAGE_SIZE];
+static char out[MAX_MSG];
+
+#define CHECK(cond) do {						\
+	if (!(cond)) {							\
+		fprintf(stderr, "%s:%d: check failed: %s\n",		\
+			__FILE__, __LINE__, #cond);			\
+		abort();						\
+	}								\
+} while (0)
+
+static void check_len(struct model *m)
+{
+	CHECK(xxx_core_len() == m->len);
+}
+
+static void op_xxx(struct model *m, int op, unsigned int arg,
+		   const char *data, size_t n)
+{
+	long long pos;
+	ssize_t res;
+	size_t len;
+
+	switch (op) {
+	case OP_STORE:
+		xxx_core_set_cpu(arg);
+		len = xxx_core_store(data, n);
+		CHECK(len <= n);
+		if (len) {
+			memcpy(m->msg, data, len);
+			m->len = len;
+		}
+		break;
+	case OP_SHOW:
+		len = xxx_core_show(page);
+		CHECK(len == (m->len < CORE_PAGE_SIZE ? m->len : CORE_PAGE_SIZE - 1));
+		CHECK(!memcmp(page, m->msg, len));
+		break;
+	case OP_WRITE:
+		pos = arg % (m->len + 1);
+		if (pos + n > MAX_MSG)
+			n = MAX_MSG - pos;
+		res = xxx_core_write(data, n, &pos);
+		CHECK(res <= (ssize_t)n);
+		if (res > 0) {
+			memcpy(m->msg + pos - res, data, res);
+			m->len = pos;
+		} else {
+			CHECK(res == 0 ? n == 0 : kshim_user_fault ||
+			      res == -ENOSPC || res == -ENOMEM);
+		}
+		break;
+	case OP_READ:
+		pos = arg % (m->len + 2);
+		res = xxx_core_read(out, n, &pos);
+		if ((size_t)(pos - (res > 0 ? res : 0)) >= m->len || !n) {
+			CHECK(res == 0);
+		} else if (kshim_user_fault) {
+			CHECK(res == -EFAULT);
+		} else {
+			len = m->len - (pos - res);
+			CHECK((size_t)res == (n < len ? n : len));
+			CHECK(!memcmp(out, m->msg + pos - res, res));
+		}
+		break;
+	case OP_TRUNCATE:
+		len = arg % (m->len + 2);
+		res = xxx_core_truncate(len);
+		if (len > m->len) {
+			CHECK(res == -EINVAL);
+		} else {
+			CHECK(res == 0);
+			m->len = len;
+		}
+		break;
+	case OP_PACK:
+		xxx_core_run_work();
+		break;
+	}
+	/* the length folds the shards, leave a store there for OP_SHOW */
+	if (!m->shards || op != OP_STORE)
+		check_len(m);
+}
+
+static void op_node(struct model *m, int op, const char *data, size_t n)
+{
+	long long pos = 0;
+	ssize_t res;
+	size_t len;
+
+	if (op == OP_NODE_WRITE) {
+		res = node_core_write(data, n);
+		len = n < NODE_LEN ? n : NODE_LEN;
+		CHECK((size_t)res == len);
+		if (!kshim_user_fault) {
+			memcpy(m->node, data, len);
+			m->node[len] = '\0';
+			m->node_known = 1;
+		} else {
+			m->node_known = 0;
+		}
+		return;
+	}
+	res = node_core_read(out, n, &pos);
+	CHECK(res >= 0 && (size_t)res <= n && res <= NODE_LEN);
+	if (m->node_known && !kshim_user_fault) {
+		len = strlen(m->node);
+		CHECK((size_t)res == (n < len ? n : len));
+		CHECK(!memcmp(out, m->node, res));
+	}
+}
+
+static void log_append(struct model *m, const char *data, size_t n)
+{
+	m->rec_off = realloc(m->rec_off, (m->nr_recs + 1) * sizeof(size_t));
+	m->rec_len = realloc(m->rec_len, (m->nr_recs + 1) * sizeof(size_t));
+	m->arena = realloc(m->arena, m->arena_len + n + 1);
+	if (!m->rec_off || !m->rec_len || !m->arena)
+		abort();
+	memcpy(m->arena + m->arena_len, data, n);
+	m->rec_off[m->nr_recs] = m->arena_len;
+	m->rec_len[m->nr_recs] = n;
+	m->arena_len += n;
+	m->nr_recs++;
+}
+
+static void defer_flush(struct model *m)
+{
+	size_t i, off = 0;
+
+	for (i = 0; i < m->nr_pend; i++) {
+		log_append(m, m->pend_arena + off, m->pend_rec[i]);
+		off += m->pend_rec[i];
+	}
+	if (m->pend_set) {
+		memcpy(m->rw, m->pend, m->pend_len);
+		m->rw_len = m->pend_len;
+		m->rw_pos = 0;
+	}
+	m->nr_pend = m->pend_arena_len = 0;
+	m->pend_set = 0;
+	memset(m->stage_used, 0, sizeof(m->stage_used));
+}
+
+/* a write staged on CPU 'arg', a full log stage flushes everything first */
+static void op_defer_write(struct model *m, unsigned int arg,
+			   const char *data, size_t n)
+{
+	unsigned int cpu = arg % RW_CPUS;
+	size_t len = n < (m->log ? RW_LOG_REC : RW_LEN) ? n :
+		     (m->log ? RW_LOG_REC : RW_LEN);
+	size_t need = (RW_STAGE_REC + len + 7) & ~(size_t)7;
+	ssize_t res;
+
+	rw_core_set_cpu(cpu);
+	res = rw_core_write(data, n);
+	if (kshim_user_fault && len) {
+		CHECK(res == -EFAULT);
+		return;
+	}
+	CHECK((size_t)res == n);
+	if (!m->log) {
+		memcpy(m->pend, data, len);
+		m->pend_len = len;
+		m->pend_set = 1;
+		return;
+	}
+	if (m->stage_used[cpu] + need > RW_STAGE_SIZE)
+		defer_flush(m);
+	m->pend_rec = realloc(m->pend_rec, (m->nr_pend + 1) * sizeof(size_t));
+	m->pend_arena = realloc(m->pend_arena, m->pend_arena_len + len + 1);
+	if (!m->pend_rec || !m->pend_arena)
+		abort();
+	memcpy(m->pend_arena + m->pend_arena_len, data, len);
+	m->pend_arena_len += len;
+	m->pend_rec[m->nr_pend++] = len;
+	m->stage_used[cpu] += need;
+}
+
+static void op_log(struct model *m, int op, unsigned int arg,
+		   const char *data, size_t n)
+{
+	void *r = m->readers[arg & 1];
+	unsigned long long seq, next;
+	ssize_t res;
+
+	if (op == OP_RW_WRITE && m->defer) {
+		op_defer_write(m, arg, data, n);
+		return;
+	}
+	if (op == OP_RW_WRITE) {
+		res = rw_core_write(data, n);
+		/* copying nothing can't fault */
+		if (kshim_user_fault && n) {
+			CHECK(res == -EFAULT);
+			return;
+		}
+		CHECK((size_t)res == n);
+		log_append(m, data, n < RW_LOG_REC ? n : RW_LOG_REC);
+		return;
+	}
+
+	seq = rw_core_log_seq(r);
+	CHECK(rw_core_log_pending(r) == (seq != m->nr_recs));
+	res = rw_core_log_read(r, out, n);
+	next = rw_core_log_seq(r);
+	CHECK(seq <= m->nr_recs && next <= m->nr_recs);
+	switch (res) {
+	case -EPIPE:
+		CHECK(next > seq);
+		break;
+	case -EAGAIN:
+		CHECK(seq == m->nr_recs && next == seq);
+		break;
+	case -EINVAL:
+		CHECK(seq < m->nr_recs && m->rec_len[seq] > n && next == seq);
+		break;
+	case -EFAULT:
+		CHECK(kshim_user_fault && next == seq + 1);
+		break;
+	default:
+		CHECK(res >= 0 && seq < m->nr_recs && next == seq + 1);
+		CHECK((size_t)res == m->rec_len[seq]);
+		CHECK(!memcmp(out, m->arena + m->rec_off[seq], res));
+	}
+}
+
+static void op_rw(struct model *m, int op, unsigned int arg,
+		  const char *data, size_t n)
+{
+	int res;
+	size_t len;
+
+	if (op == OP_RW_WRITE && m->defer) {
+		op_defer_write(m, arg, data, n);
+		return;
+	}
+	if (op == OP_RW_WRITE) {
+		res = rw_core_write(data, n);
+		CHECK((size_t)res == n);
+		len = n < RW_LEN ? n : RW_LEN;
+		/* pinned: the whole write, still in the input buffer */
+		if (m->rw_zerocopy && n >= m->rw_zerocopy)
+			len = n;
+		m->rw_len = kshim_user_fault ? 0 : len;
+		memcpy(m->rw, data, m->rw_len);
+		m->rw_pos = 0;
+		return;
+	}
+	res = rw_core_read(out, n);
+	len = m->rw_len - m->rw_pos;
+	if (n < len)
+		len = n;
+	if (kshim_user_fault) {
+		CHECK(res == 0);
+		return;
+	}
+	CHECK((size_t)res == len);
+	CHECK(!memcmp(out, m->rw + m->rw_pos, len));
+	m->rw_pos += len;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	static struct model m;
+	unsigned int arg;
+	size_t n;
+	int op;
+
+	if (size < 1)
+		return 0;
+	if (!m.msg) {
+		m.msg = malloc(MAX_MSG);
+		if (!m.msg)
+			abort();
+	}
+	kshim_user_fault = 0;
+	m.rw_zerocopy = data[0] / 3 % 2 ? RW_ZEROCOPY : 0;
+	m.log = data[0] / 6 % 2;
+	m.defer = data[0] / 12 % 2;
+	m.nr_recs = m.arena_len = 0;
+	m.nr_pend = m.pend_arena_len = 0;
+	m.pend_set = 0;
+	memset(m.stage_used, 0, sizeof(m.stage_used));
+	m.shards = data[0] / 24 % 2;
+	/* a one-object reserve: scripts run it empty, full and spilling;
+	 * a 1 KiB cache fits some packed messages and not others */
+	if (xxx_core_init(data[0] % 3, 64, m.shards, data[0] / 48 % 2 ? 1 : 0,
+			  data[0] / 96 % 2 ? 1 : 0) ||
+	    rw_core_init(m.rw_zerocopy, m.log ? RW_LOG_SIZE : 0, m.defer))
+		abort();
+	if (m.log) {
+		m.readers[0] = rw_core_log_open();
+		m.readers[1] = rw_core_log_open();
+		if (!m.readers[0] || !m.readers[1])
+			abort();
+	}
+	memcpy(m.msg, "Hi!\n", 4);
+	m.len = 4;
+	m.rw_len = m.rw_pos = 0;
+	m.node_known = 0;
+	data++;
+	size--;
+
+	while (size >= 5) {
+		op = data[0] % NR_OPS;
+		arg = data[1] | data[2] << 8;
+		n = data[3] | data[4] << 8;
+		data += 5;
+		size -= 5;
+		if (op == OP_STORE || op == OP_WRITE || op == OP_NODE_WRITE ||
+		    op == OP_RW_WRITE) {
+			if (n > size)
+				n = size;
+		} else if (n > sizeof(out)) {
+			n = sizeof(out);
+		}
+
+		if (op == OP_FAULT)
+			kshim_user_fault = !kshim_user_fault;
+		else if (op <= OP_PACK)
+			op_xxx(&m, op, arg, (const char *)data, n);
+		else if (op <= OP_NODE_READ)
+			op_node(&m, op, (const char *)data, n);
+		else if (op == OP_RW_FLUSH) {
+			rw_core_flush();
+			defer_flush(&m);
+		} else if (m.log)
+			op_log(&m, op, arg, (const char *)data, n);
+		else
+			op_rw(&m, op, arg, (const char *)data, n);
+
+		if (op == OP_STORE || op == OP_WRITE || op == OP_NODE_WRITE ||
+		    op == OP_RW_WRITE) {
+			data += n;
+			size -= n;
+		}
+	}
+	kshim_user_fault = 0;
+	if (m.log) {
+		rw_core_log_close(m.readers[0]);
+		rw_core_log_close(m.readers[1]);
+	}
+	rw_core_exit();
+	xxx_core_exit();
+	return 0;
+}
+
+#ifdef FUZZ_STANDALONE
+static int run_file(const char *path)
+{
+	static uint8_t buf[1 << 20];
+	FILE *f = fopen(path, "rb");
+	size_t n;
+
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+	n = fread(buf, 1, sizeof(buf), f);
+	fclose(f);
+	LLVMFuzzerTestOneInput(buf, n);
+	return 0;
+}
+
+/* a script of random operations with mostly short payloads */
+static size_t random_input(uint8_t *buf, size_t max)
+{
+	size_t len = 1, n;
+	int op;
+
+	buf[0] = rand();
+	while (len + 5 < max && rand() % 64) {
+		n = rand() % 8 ? rand() % 300 : rand() % 20000;
+		op = rand() % NR_OPS;
+		buf[len++] = op;
+		buf[len++] = rand() % 4 ? rand() % 64 : rand();
+		buf[len++] = rand() % 4 ? 0 : rand();
+		buf[len++] = n;
+		buf[len++] = n >> 8;
+		/* only writes take data, anything else would be read as ops */
+		if (op != OP_STORE && op != OP_WRITE && op != OP_NODE_WRITE &&
+		    op != OP_RW_WRITE)
+			continue;
+		if (n > max - len)
+			n = max - len;
+		while (n--)
+			buf[len++] = 'a' + rand() % 4;
+	}
+	return len;
+}
+
+int main(int argc, char *argv[])
+{
+	static uint8_t buf[1 << 18];
+	unsigned long runs = 10000, i;
+	unsigned int seed = 1;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:s:")) != -1) {
+		switch (opt) {
+		case 'n':
+			runs = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n runs] [-s seed] [file...]\n",
+				argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (optind < argc) {
+		for (; optind < argc; optind++)
+			if (run_file(argv[optind]))
+				return EXIT_FAILURE;
+		return EXIT_SUCCESS;
+	}
+
+	srand(seed);
+	for (i = 0; i < runs; i++)
+		LLVMFuzzerTestOneInput(buf, random_input(buf, sizeof(buf)));
+	printf("%lu random inputs ok\n", runs);
+	return EXIT_SUCCESS;
+}
+#endif
@@ -0,0 +1,2 @@
+/* kshim stand-in for <linux/jump_label.h> */
+#include <kshim.h>
@@ -0,0 +1,2 @@
+/* kshim stand-in for <linux/moduleparam.h> */
+#include <kshim.h>
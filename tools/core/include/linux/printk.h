@@ -0,0 +1,2 @@
+/* kshim stand-in for <linux/printk.h> */
+#include <kshim.h>
@@ -0,0 +1,14 @@
+/* kshim stand-in for <linux/tracepoint.h>: every event is an empty inline */
+#include <kshim.h>
+
+#define TP_PROTO(args...)	args
+#define TP_ARGS(args...)	args
+
+#undef TRACE_EVENT
+#define TRACE_EVENT(name, proto, ...) \
+	static inline void trace_##name(proto) { }
+#undef DECLARE_EVENT_CLASS
+#define DECLARE_EVENT_CLASS(name, ...)
+#undef DEFINE_EVENT
+#define DEFINE_EVENT(template, name, proto, ...) \
+	static inline void trace_##name(proto) { }
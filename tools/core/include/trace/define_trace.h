@@ -0,0 +1 @@
+/* kshim stand-in for <trace/define_trace.h>: nothing to instantiate */
@@ -0,0 +1,73 @@
+#include <stdarg.h>
+#include "kshim.h"
+
+int kshim_user_fault;
+int kshim_verbose;
+int kshim_cpu;
+
+int printk(const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	if (!kshim_verbose)
+		return 0;
+	va_start(ap, fmt);
+	n = vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	return n;
+}
+
+struct kmem_cache *kmem_cache_create(const char *name, size_t size,
+				     size_t align, unsigned long flags,
+				     void (*ctor)(void *p))
+{
+	struct kmem_cache *s = malloc(sizeof(*s));
+
+	if (s) {
+		s->size = size;
+		s->ctor = ctor;
+	}
+	return s;
+}
+
+void kmem_cache_destroy(struct kmem_cache *s)
+{
+	free(s);
+}
+
+void *kmem_cache_alloc(struct kmem_cache *s, gfp_t flags)
+{
+	void *p = malloc(s->size);
+
+	if (p && s->ctor)
+		s->ctor(p);
+	return p;
+}
+
+void kmem_cache_free(struct kmem_cache *s, void *p)
+{
+	free(p);
+}
+
+/* all or nothing, like the kernel's */
+int kmem_cache_alloc_bulk(struct kmem_cache *s, gfp_t flags, size_t size,
+			  void **p)
+{
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		p[i] = kmem_cache_alloc(s, flags);
+		if (!p[i]) {
+			kmem_cache_free_bulk(s, i, p);
+			return 0;
+		}
+	}
+	return size;
+}
+
+void kmem_cache_free_bulk(struct kmem_cache *s, size_t size, void **p)
+{
+	while (size--)
+		kmem_cache_free(s, p[size]);
+}
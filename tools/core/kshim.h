@@ -0,0 +1,380 @@
+/*
+ * Thin user space stand-ins for the kernel API used by the module core
+ * files (mm/xxx_msg.c, procfs_rw/rw_buf.c, examples.245.proc/fops_rw.c).
+ *
+ * Only what those files need, with the same names and calling conventions.
+ * Memory comes from malloc, copy_{to,from}_user are memcpy (or fail, see
+ * kshim_user_fault), locks are pthread mutexes. RCU callbacks run at once,
+ * so the core code must be driven from one thread at a time.
+ */
+#ifndef KSHIM_H
+#define KSHIM_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+typedef uint8_t		u8;
+typedef uint16_t	u16;
+typedef uint32_t	u32;
+typedef uint64_t	u64;
+typedef int64_t		s64;
+typedef unsigned int	gfp_t;
+
+#define __user
+#define __rcu
+#define __init
+#define __exit
+#define likely(x)	__builtin_expect(!!(x), 1)
+#define unlikely(x)	__builtin_expect(!!(x), 0)
+
+#define PAGE_SHIFT	12
+#define PAGE_SIZE	(1UL << PAGE_SHIFT)
+#define PAGE_MASK	(~(PAGE_SIZE - 1))
+#define offset_in_page(p)	((unsigned long)(p) & ~PAGE_MASK)
+#define DIV_ROUND_UP(n, d)	(((n) + (d) - 1) / (d))
+#define ALIGN(x, a)		(((x) + (a) - 1) & ~((__typeof__(x))(a) - 1))
+static inline unsigned long roundup_pow_of_two(unsigned long n)
+{
+	unsigned long r = 1;
+
+	while (r < n)
+		r <<= 1;
+	return r;
+}
+#define GFP_KERNEL	0u
+#define GFP_ATOMIC	1u
+#define GFP_NOWAIT	2u
+#define __GFP_NOWARN	4u
+
+/* knobs for the harnesses */
+extern int kshim_user_fault;	/* copy_{to,from}_user copy nothing */
+extern int kshim_verbose;	/* printk goes to stderr */
+
+struct module {
+	const char *name;
+};
+#define THIS_MODULE	(&(const struct module){ .name = "kshim" })
+
+struct file {
+	void *private_data;
+};
+
+/* printk */
+#define KERN_ERR	""
+#define KERN_WARNING	""
+#define KERN_NOTICE	""
+#define KERN_INFO	""
+int printk(const char *fmt, ...);
+#define pr_err(...)	printk(__VA_ARGS__)
+#define pr_warn(...)	printk(__VA_ARGS__)
+#define pr_notice(...)	printk(__VA_ARGS__)
+#define pr_info(...)	printk(__VA_ARGS__)
+
+/* helpers */
+#define min(a, b)	((a) < (b) ? (a) : (b))
+#define max(a, b)	((a) > (b) ? (a) : (b))
+#define min_t(t, a, b)	min((t)(a), (t)(b))
+#define max_t(t, a, b)	max((t)(a), (t)(b))
+#define container_of(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+#define READ_ONCE(x)		(*(volatile __typeof__(x) *)&(x))
+#define WRITE_ONCE(x, v)	(*(volatile __typeof__(x) *)&(x) = (v))
+#define smp_load_acquire(p)	__atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define smp_store_release(p, v)	__atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define cmpxchg(p, o, n) ({						\
+	__typeof__(*(p)) __old = (o);					\
+	__atomic_compare_exchange_n(p, &__old, n, false,		\
+				    __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);\
+	__old; })
+#define xchg(p, v)		__atomic_exchange_n(p, v, __ATOMIC_SEQ_CST)
+#define div64_u64(a, b)		((u64)(a) / (u64)(b))
+
+/* atomics */
+typedef struct { int counter; } atomic_t;
+typedef struct { long long counter; } atomic64_t;
+#define atomic64_read(v)	__atomic_load_n(&(v)->counter, __ATOMIC_RELAXED)
+#define atomic64_add(i, v)	__atomic_add_fetch(&(v)->counter, i, __ATOMIC_RELAXED)
+#define atomic64_inc(v)		atomic64_add(1, v)
+#define atomic64_sub(i, v)	__atomic_sub_fetch(&(v)->counter, i, __ATOMIC_RELAXED)
+#define atomic64_add_return(i, v) \
+	__atomic_add_fetch(&(v)->counter, i, __ATOMIC_RELAXED)
+#define atomic64_inc_return(v)	__atomic_add_fetch(&(v)->counter, 1, __ATOMIC_RELAXED)
+
+typedef struct { int refs; } refcount_t;
+static inline void refcount_set(refcount_t *r, int n)
+{
+	__atomic_store_n(&r->refs, n, __ATOMIC_RELAXED);
+}
+static inline bool refcount_inc_not_zero(refcount_t *r)
+{
+	int old = __atomic_load_n(&r->refs, __ATOMIC_RELAXED);
+
+	while (old && !__atomic_compare_exchange_n(&r->refs, &old, old + 1,
+			false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+	return old != 0;
+}
+static inline bool refcount_dec_and_test(refcount_t *r)
+{
+	return __atomic_sub_fetch(&r->refs, 1, __ATOMIC_ACQ_REL) == 0;
+}
+
+/* locking */
+struct mutex {
+	pthread_mutex_t m;
+};
+#define DEFINE_MUTEX(name)	struct mutex name = { PTHREAD_MUTEX_INITIALIZER }
+#define mutex_init(l)		pthread_mutex_init(&(l)->m, NULL)
+#define mutex_lock(l)		pthread_mutex_lock(&(l)->m)
+#define mutex_trylock(l)	(pthread_mutex_trylock(&(l)->m) == 0)
+#define mutex_unlock(l)		pthread_mutex_unlock(&(l)->m)
+#define lockdep_is_held(l)	1
+
+typedef struct mutex spinlock_t;
+#define DEFINE_SPINLOCK(name)	DEFINE_MUTEX(name)
+#define spin_lock(l)		mutex_lock(l)
+#define spin_unlock(l)		mutex_unlock(l)
+#define spin_lock_init(l)	mutex_init(l)
+#define spin_lock_irqsave(l, flags)	do { (flags) = 0; mutex_lock(l); } while (0)
+#define spin_unlock_irqrestore(l, flags) do { (void)(flags); mutex_unlock(l); } while (0)
+
+/* per-CPU data: KSHIM_NR_CPUS copies, the harness picks the current CPU */
+#define KSHIM_NR_CPUS		4
+extern int kshim_cpu;
+
+#define __percpu
+#define nr_cpu_ids		KSHIM_NR_CPUS
+#define alloc_percpu(type)	((type *)calloc(KSHIM_NR_CPUS, sizeof(type)))
+#define free_percpu(p)		free(p)
+#define per_cpu_ptr(p, cpu)	(&(p)[cpu])
+#define raw_cpu_ptr(p)		per_cpu_ptr(p, kshim_cpu)
+#define get_cpu_ptr(p)		raw_cpu_ptr(p)
+#define put_cpu_ptr(p)		do { } while (0)
+#define for_each_possible_cpu(cpu) \
+	for ((cpu) = 0; (cpu) < KSHIM_NR_CPUS; (cpu)++)
+
+/* nobody sleeps here, so there is nobody to wake */
+struct wait_queue_head {
+	int unused;
+};
+typedef struct wait_queue_head wait_queue_head_t;
+#define DECLARE_WAIT_QUEUE_HEAD(name)	struct wait_queue_head name = { 0 }
+#define init_waitqueue_head(q)		((void)(q))
+#define wq_has_sleeper(q)		((void)(q), 0)
+#define wake_up_interruptible(q)	((void)(q))
+
+/* RCU: no concurrent readers, so a grace period is over at once */
+struct rcu_head {
+	struct rcu_head *next;
+	void (*func)(struct rcu_head *head);
+};
+#define rcu_read_lock()			do { } while (0)
+#define rcu_read_unlock()		do { } while (0)
+#define rcu_dereference(p)		smp_load_acquire(&(p))
+#define rcu_dereference_protected(p, c)	(p)
+#define rcu_assign_pointer(p, v)	smp_store_release(&(p), (v))
+#define RCU_INIT_POINTER(p, v)		((p) = (v))
+#define rcu_barrier()			do { } while (0)
+static inline void call_rcu(struct rcu_head *head,
+			    void (*func)(struct rcu_head *head))
+{
+	func(head);
+}
+
+/* static keys and module parameters */
+struct static_key_false {
+	bool enabled;
+};
+#define DEFINE_STATIC_KEY_FALSE(name)	struct static_key_false name = { false }
+#define static_branch_unlikely(k)	unlikely((k)->enabled)
+#define static_branch_enable(k)		((k)->enabled = true)
+#define static_branch_disable(k)	((k)->enabled = false)
+
+struct kernel_param;
+struct kernel_param_ops {
+	int (*set)(const char *val, const struct kernel_param *kp);
+	int (*get)(char *buffer, const struct kernel_param *kp);
+};
+static inline int param_set_bool(const char *val, const struct kernel_param *kp)
+{
+	return 0;
+}
+static inline int param_get_bool(char *buffer, const struct kernel_param *kp)
+{
+	return 0;
+}
+#define module_param_cb(name, ops, arg, perm) \
+	static const void *__param_##name __attribute__((unused)) = (ops)
+#define module_param_named(name, value, type, perm) \
+	static const void *__param_##name __attribute__((unused)) = &(value)
+#define module_param(name, type, perm) module_param_named(name, name, type, perm)
+
+/* memory */
+static inline void *kmalloc(size_t size, gfp_t flags)
+{
+	return malloc(size);
+}
+static inline void *kzalloc(size_t size, gfp_t flags)
+{
+	return calloc(1, size);
+}
+#define kvmalloc(size, flags)	kmalloc(size, flags)
+#define kvmalloc_array(n, size, flags)	kmalloc((n) * (size), flags)
+#define vmalloc(size)		kmalloc(size, GFP_KERNEL)
+#define kfree(p)		free((void *)(p))
+#define kvfree(p)		free((void *)(p))
+#define vfree(p)		free((void *)(p))
+
+struct kmem_cache {
+	size_t size;
+	void (*ctor)(void *p);
+};
+struct kmem_cache *kmem_cache_create(const char *name, size_t size,
+				     size_t align, unsigned long flags,
+				     void (*ctor)(void *p));
+void kmem_cache_destroy(struct kmem_cache *s);
+void *kmem_cache_alloc(struct kmem_cache *s, gfp_t flags);
+void kmem_cache_free(struct kmem_cache *s, void *p);
+int kmem_cache_alloc_bulk(struct kmem_cache *s, gfp_t flags, size_t size,
+			  void **p);
+void kmem_cache_free_bulk(struct kmem_cache *s, size_t size, void **p);
+
+/* a user page is just its address here, pinning only records it */
+struct page {
+	void *addr;
+};
+#define FOLL_LONGTERM	0
+static inline int pin_user_pages_fast(unsigned long start, int nr_pages,
+				      unsigned int gup_flags,
+				      struct page **pages)
+{
+	int i;
+
+	if (kshim_user_fault)
+		return -EFAULT;
+	for (i = 0; i < nr_pages; i++) {
+		pages[i] = malloc(sizeof(**pages));
+		if (!pages[i])
+			break;
+		pages[i]->addr = (void *)(start + i * PAGE_SIZE);
+	}
+	return i ? i : -ENOMEM;
+}
+static inline void unpin_user_pages(struct page **pages, unsigned long npages)
+{
+	while (npages--)
+		free(pages[npages]);
+}
+#define kmap(page)	((page)->addr)
+#define kunmap(page)	do { } while (0)
+
+/* user copies */
+static inline unsigned long copy_to_user(void __user *to, const void *from,
+					 unsigned long n)
+{
+	if (kshim_user_fault)
+		return n;
+	memcpy(to, from, n);
+	return 0;
+}
+static inline unsigned long copy_from_user(void *to, const void __user *from,
+					   unsigned long n)
+{
+	if (kshim_user_fault)
+		return n;
+	memcpy(to, from, n);
+	return 0;
+}
+
+/* time, strictly increasing so back to back stamps still order */
+static inline u64 ktime_get_ns(void)
+{
+	static u64 last;
+	struct timespec ts;
+	u64 now;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	now = (u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	last = now > last ? now : last + 1;
+	return last;
+}
+#define msecs_to_jiffies(ms)	((unsigned long)(ms))
+#define jiffies			((unsigned long)(ktime_get_ns() / 1000000))
+#define time_before(a, b)	((long)((a) - (b)) < 0)
+
+/* delayed work only runs when the harness calls kshim_run_work() */
+struct work_struct {
+	int unused;
+};
+struct delayed_work {
+	struct work_struct work;
+	void (*func)(struct work_struct *work);
+	bool pending;
+};
+#define DECLARE_DELAYED_WORK(name, fn) \
+	struct delayed_work name = { .func = (fn) }
+#define system_wq	NULL
+static inline bool mod_delayed_work(void *wq, struct delayed_work *dw,
+				    unsigned long delay)
+{
+	bool was = dw->pending;
+
+	dw->pending = true;
+	return was;
+}
+static inline bool schedule_delayed_work(struct delayed_work *dw,
+					 unsigned long delay)
+{
+	bool was = dw->pending;
+
+	dw->pending = true;
+	return !was;
+}
+
+static inline bool cancel_delayed_work_sync(struct delayed_work *dw)
+{
+	bool was = dw->pending;
+
+	dw->pending = false;
+	return was;
+}
+static inline void kshim_run_work(struct delayed_work *dw)
+{
+	if (dw->pending) {
+		dw->pending = false;
+		dw->func(&dw->work);
+	}
+}
+
+/* LZ4: liblz4 when built with HAVE_LZ4, otherwise nothing ever packs */
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#define LZ4_MEM_COMPRESS	LZ4_sizeofState()
+#define LZ4_compress_default(src, dst, n, max, wrkmem) \
+	LZ4_compress_fast_extState(wrkmem, src, dst, n, max, 1)
+#else
+#define LZ4_MEM_COMPRESS	1
+#define LZ4_MAX_INPUT_SIZE	0x7E000000
+#define LZ4_compressBound(n)	((n) + (n) / 255 + 16)
+static inline int LZ4_compress_default(const char *src, char *dst, int n,
+				       int max, void *wrkmem)
+{
+	return 0;
+}
+static inline int LZ4_decompress_safe_partial(const char *src, char *dst,
+					      int n, int target, int max)
+{
+	return -1;
+}
+#endif
+
+#endif /* KSHIM_H */
@@ -0,0 +1,80 @@
+/* lesson-03-modules-interfaces/procfs_rw/rw_buf.c against kshim.h */
+#include <kshim.h>
+#include "rw_trace.h"
+#include "core.h"
+
+#define MODULE_TAG	"example_module "
+
+#include <dbgkey.h>
+
+#include "rw_buf.c"
+
+int rw_core_init(unsigned long zerocopy, unsigned int log, unsigned int defer)
+{
+	zerocopy_min = zerocopy;
+	defer_ms = defer;
+	log_mode = log != 0;
+	log_size = log;
+	return create_buffer();
+}
+
+void rw_core_exit(void)
+{
+	cleanup_buffer();
+}
+
+int rw_core_read(char *buf, size_t count)
+{
+	struct example_file f = { .buf = &proc_buf };
+	struct file file = { .private_data = &f };
+	loff_t off = 0;
+
+	return example_read(&file, buf, count, &off);
+}
+
+void *rw_core_log_open(void)
+{
+	return log_open();
+}
+
+void rw_core_log_close(void *reader)
+{
+	kfree(reader);
+}
+
+ssize_t rw_core_log_read(void *reader, char *buf, size_t count)
+{
+	return log_read(reader, buf, count);
+}
+
+int rw_core_log_pending(void *reader)
+{
+	return log_pending(reader);
+}
+
+unsigned long long rw_core_log_seq(void *reader)
+{
+	return ((struct log_reader *)reader)->seq;
+}
+
+int rw_core_write(const char *buf, size_t count)
+{
+	struct example_file f = { .buf = &proc_buf };
+	struct file file = { .private_data = &f };
+	loff_t off = 0;
+
+	if (log_mode)
+		return defer_ms ? defer_write(buf, count) : log_write(buf, count);
+	return example_write(&file, buf, count, &off);
+}
+
+/* what defer_work would do once defer_ms passed */
+void rw_core_flush(void)
+{
+	kshim_run_work(&defer_work);
+}
+
+void rw_core_set_cpu(int cpu)
+{
+	kshim_cpu = cpu % KSHIM_NR_CPUS;
+}
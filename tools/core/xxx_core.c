@@ -0,0 +1,105 @@
+/* lesson-04-memory-management/mm/xxx_msg.c against kshim.h */
+#include <kshim.h>
+#include "xxx_trace.h"
+#include "core.h"
+
+#include <dbgkey.h>
+
+#include "xxx_msg.c"
+
+int xxx_core_init(int mem_config, unsigned int lz4_threshold, int shards,
+		  unsigned int cache_prefill, unsigned int lz4_cache_kb)
+{
+	const char *initial_buffer = "Hi!\n";
+
+	if (kshim_verbose)
+		static_branch_enable(&dbg_key);
+	g_mem_config = mem_config;
+	g_lz4_threshold = lz4_threshold;
+	g_shards = shards;
+	g_cache_prefill = cache_prefill;
+	g_lz4_cache_kb = lz4_cache_kb;
+	/* xxx_core_run_work() drops a cached copy at once */
+	g_lz4_cache_ms = 0;
+	initialize_memory();
+	if ((g_mem_config == MEM_CONFIG_KMCACHE && !g_cache) ||
+	    (shards && !g_shards))
+		return -ENOMEM;
+
+	mutex_lock(&g_msg_lock);
+	store_to_buffer(initial_buffer, strlen(initial_buffer));
+	mutex_unlock(&g_msg_lock);
+	return 0;
+}
+
+void xxx_core_exit(void)
+{
+	release_msg();
+	finalize_memory();
+}
+
+size_t xxx_core_store(const char *buf, size_t count)
+{
+	if (g_shards)
+		return store_to_shard(buf, count);
+	mutex_lock(&g_msg_lock);
+	count = store_to_buffer(buf, count);
+	mutex_unlock(&g_msg_lock);
+	return count;
+}
+
+size_t xxx_core_show(char *page)
+{
+	return show_from_buffer(page);
+}
+
+ssize_t xxx_core_read(char *buf, size_t count, long long *pos)
+{
+	loff_t off = *pos;
+	ssize_t res = xxx_dev_read(NULL, buf, count, &off);
+
+	*pos = off;
+	return res;
+}
+
+ssize_t xxx_core_write(const char *buf, size_t count, long long *pos)
+{
+	loff_t off = *pos;
+	ssize_t res = xxx_dev_write(NULL, buf, count, &off);
+
+	*pos = off;
+	return res;
+}
+
+long xxx_core_truncate(uint64_t len)
+{
+	long res;
+
+	mutex_lock(&g_msg_lock);
+	res = truncate_buffer(len);
+	mutex_unlock(&g_msg_lock);
+	return res;
+}
+
+size_t xxx_core_len(void)
+{
+	return msg_len();
+}
+
+int xxx_core_packed(void)
+{
+	struct xxx_msg *msg = rcu_dereference(g_msg);
+
+	return msg && msg->zlen;
+}
+
+void xxx_core_run_work(void)
+{
+	kshim_run_work(&g_pack_work);
+	kshim_run_work(&g_plain_work);
+}
+
+void xxx_core_set_cpu(int cpu)
+{
+	kshim_cpu = cpu % KSHIM_NR_CPUS;
+}
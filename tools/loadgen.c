@@ -0,0 +1,420 @@
+/*
+ * Multi-threaded load generator for the lesson module interfaces.
+ *
+ * Every selected interface is driven by 1, 2, 4 ... N threads (each pinned
+ * to its own CPU) running a mix of reads and writes for a fixed time. For
+ * every step ops/s, latency percentiles and the scaling against the single
+ * thread run are printed, as a table or as CSV for regression tracking.
+ *
+ *   loadgen -l                     list known interfaces
+ *   loadgen -i xxx,proc_buffer -w 20 -t 8 -d 2
+ *   loadgen -f /some/file -w 0 -c  arbitrary sysfs/procfs file, CSV output
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#define HIST_SUB	16
+#define HIST_BUCKETS	(64 * HIST_SUB)
+#define MAX_IFACES	16
+
+enum kind { KIND_FILE, KIND_INT80 };
+
+struct iface {
+	const char *name;
+	const char *path;
+	enum kind kind;
+	int writable;
+};
+
+static struct iface known[] = {
+	{ "xxx",	 "/sys/class/x-class/xxx",	  KIND_FILE, 1 },
+	{ "data1",	 "/sys/class/x-class/data1",	  KIND_FILE, 1 },
+	{ "data2",	 "/sys/class/x-class/data2",	  KIND_FILE, 1 },
+	{ "data3",	 "/sys/class/x-class/data3",	  KIND_FILE, 1 },
+	{ "tm_jif",	 "/sys/class/tm_jif-class/tm_jif", KIND_FILE, 0 },
+	{ "proc_buffer", "/proc/example/buffer",	  KIND_FILE, 1 },
+	{ "mod_node",	 "/proc/mod_dir/mod_node",	  KIND_FILE, 1 },
+	{ "int80",	 NULL,				  KIND_INT80, 1 },
+};
+
+#define NR_KNOWN	(sizeof(known) / sizeof(known[0]))
+
+struct config {
+	struct iface *ifaces[MAX_IFACES];
+	int nr_ifaces;
+	int max_threads;
+	int write_pct;
+	double duration;
+	const char *msg;
+	size_t msg_len;
+	int csv;
+	int only_max;
+};
+
+struct worker {
+	pthread_t thread;
+	int cpu;
+	struct iface *iface;
+	const struct config *cfg;
+	unsigned long ops, errors;
+	uint64_t hist[HIST_BUCKETS];
+};
+
+static volatile int stop;
+static pthread_barrier_t barrier;
+static int *cpus;
+static int nr_cpus;
+static char *low_buf;		/* below 4G, for int 0x80 pointers */
+
+static inline uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* log-linear buckets: exact below 32 ns, then 16 per power of two */
+static inline int hist_index(uint64_t v)
+{
+	int shift;
+
+	if (v < 2 * HIST_SUB)
+		return v;
+	shift = 63 - __builtin_clzll(v) - 4;
+	return shift * HIST_SUB + (int)(v >> shift);
+}
+
+static inline uint64_t hist_value(int idx)
+{
+	int shift;
+
+	if (idx < 2 * HIST_SUB)
+		return idx;
+	shift = idx / HIST_SUB - 1;
+	return (uint64_t)(idx - shift * HIST_SUB) << shift;
+}
+
+static uint64_t hist_percentile(const uint64_t *hist, uint64_t total, double p)
+{
+	uint64_t want = (uint64_t)(total * p), seen = 0;
+	int i;
+
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		seen += hist[i];
+		if (seen > want)
+			return hist_value(i);
+	}
+	return hist_value(HIST_BUCKETS - 1);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+static inline long int80(long nr, long a, long b, long c)
+{
+	long res;
+
+	__asm__ volatile ("int $0x80"
+			  : "=a" (res)
+			  : "0" (nr), "b" (a), "c" (b), "d" (c)
+			  : "memory");
+	return res;
+}
+#define NR32_WRITE	4
+#define NR32_GETPID	20
+#endif
+
+static void *worker_fn(void *arg)
+{
+	struct worker *w = arg;
+	const struct config *cfg = w->cfg;
+	unsigned int seed = w->cpu * 7919 + 1;
+	int fd_r = -1, fd_w = -1, devnull = -1;
+	char buf[4096];
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(w->cpu, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+
+	if (w->iface->kind == KIND_FILE) {
+		fd_r = open(w->iface->path, O_RDONLY);
+		if (w->iface->writable && cfg->write_pct)
+			fd_w = open(w->iface->path, O_WRONLY);
+	} else {
+		devnull = open("/dev/null", O_WRONLY);
+	}
+
+	pthread_barrier_wait(&barrier);
+	while (!stop) {
+		int write = w->iface->writable &&
+			    (int)(rand_r(&seed) % 100) < cfg->write_pct;
+		uint64_t t0 = now_ns(), t1;
+		long res;
+
+		if (w->iface->kind == KIND_FILE) {
+			if (write)
+				res = pwrite(fd_w, cfg->msg, cfg->msg_len, 0);
+			else
+				res = pread(fd_r, buf, sizeof(buf), 0);
+		} else {
+#if defined(__x86_64__) || defined(__i386__)
+			if (write)
+				res = int80(NR32_WRITE, devnull,
+					    (long)(uintptr_t)low_buf,
+					    cfg->msg_len);
+			else
+				res = int80(NR32_GETPID, 0, 0, 0);
+#else
+			res = -ENOSYS;
+#endif
+		}
+		t1 = now_ns();
+
+		if (res < 0)
+			w->errors++;
+		w->ops++;
+		w->hist[hist_index(t1 - t0)]++;
+	}
+
+	if (fd_r >= 0)
+		close(fd_r);
+	if (fd_w >= 0)
+		close(fd_w);
+	if (devnull >= 0)
+		close(devnull);
+	return NULL;
+}
+
+static int iface_usable(const struct iface *f)
+{
+	if (f->kind == KIND_INT80) {
+#if defined(__x86_64__) || defined(__i386__)
+		return low_buf != NULL;
+#else
+		return 0;
+#endif
+	}
+	return access(f->path, R_OK) == 0;
+}
+
+/* returns ops/s */
+static double run_step(const struct config *cfg, struct iface *f, int threads,
+		       double base)
+{
+	struct worker *w = calloc(threads, sizeof(*w));
+	uint64_t hist[HIST_BUCKETS] = { 0 };
+	unsigned long ops = 0, errors = 0;
+	uint64_t start, elapsed, max = 0;
+	double rate;
+	int i, j;
+
+	if (!w) {
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+	stop = 0;
+	pthread_barrier_init(&barrier, NULL, threads + 1);
+	for (i = 0; i < threads; i++) {
+		w[i].cpu = cpus[i % nr_cpus];
+		w[i].iface = f;
+		w[i].cfg = cfg;
+		pthread_create(&w[i].thread, NULL, worker_fn, &w[i]);
+	}
+	pthread_barrier_wait(&barrier);
+	start = now_ns();
+	usleep((useconds_t)(cfg->duration * 1e6));
+	stop = 1;
+	for (i = 0; i < threads; i++)
+		pthread_join(w[i].thread, NULL);
+	elapsed = now_ns() - start;
+	pthread_barrier_destroy(&barrier);
+
+	for (i = 0; i < threads; i++) {
+		ops += w[i].ops;
+		errors += w[i].errors;
+		for (j = 0; j < HIST_BUCKETS; j++) {
+			hist[j] += w[i].hist[j];
+			if (w[i].hist[j] && hist_value(j) > max)
+				max = hist_value(j);
+		}
+	}
+	free(w);
+
+	rate = ops * 1e9 / elapsed;
+	if (cfg->csv)
+		printf("%s,%d,%d,%.0f,%llu,%llu,%llu,%llu,%llu,%lu\n",
+		       f->name, threads, f->writable ? cfg->write_pct : 0, rate,
+		       (unsigned long long)hist_percentile(hist, ops, 0.50),
+		       (unsigned long long)hist_percentile(hist, ops, 0.90),
+		       (unsigned long long)hist_percentile(hist, ops, 0.99),
+		       (unsigned long long)hist_percentile(hist, ops, 0.999),
+		       (unsigned long long)max, errors);
+	else
+		printf("%-12s %4d %12.0f %8.2f %9llu %9llu %9llu %9llu %10llu %8lu\n",
+		       f->name, threads, rate, base ? rate / base : 1.0,
+		       (unsigned long long)hist_percentile(hist, ops, 0.50),
+		       (unsigned long long)hist_percentile(hist, ops, 0.90),
+		       (unsigned long long)hist_percentile(hist, ops, 0.99),
+		       (unsigned long long)hist_percentile(hist, ops, 0.999),
+		       (unsigned long long)max, errors);
+	fflush(stdout);
+	return rate;
+}
+
+static struct iface *find_iface(const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < NR_KNOWN; i++)
+		if (!strcmp(known[i].name, name))
+			return &known[i];
+	return NULL;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-i iface,...] [-f file] [-w write%%] [-t threads]\n"
+		"          [-d seconds] [-m message] [-N] [-c] [-l]\n"
+		"  -i  interfaces to drive (default: all present)\n"
+		"  -f  additional sysfs/procfs file\n"
+		"  -w  percentage of writes (default 0)\n"
+		"  -t  max threads (default: allowed CPUs)\n"
+		"  -d  seconds per step (default 1)\n"
+		"  -m  message written (default \"hello\\n\")\n"
+		"  -N  only run with max threads, no scaling curve\n"
+		"  -c  CSV output\n"
+		"  -l  list known interfaces\n", prog);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	struct config cfg = {
+		.duration = 1.0,
+		.msg = "hello\n",
+	};
+	struct iface extra = { "file", NULL, KIND_FILE, 1 };
+	char *names = NULL;
+	cpu_set_t allowed;
+	int opt, i, t;
+	size_t k;
+
+	while ((opt = getopt(argc, argv, "i:f:w:t:d:m:Ncl")) != -1) {
+		switch (opt) {
+		case 'i':
+			names = optarg;
+			break;
+		case 'f':
+			extra.path = optarg;
+			break;
+		case 'w':
+			cfg.write_pct = atoi(optarg);
+			break;
+		case 't':
+			cfg.max_threads = atoi(optarg);
+			break;
+		case 'd':
+			cfg.duration = atof(optarg);
+			break;
+		case 'm':
+			cfg.msg = optarg;
+			break;
+		case 'N':
+			cfg.only_max = 1;
+			break;
+		case 'c':
+			cfg.csv = 1;
+			break;
+		case 'l':
+			for (k = 0; k < NR_KNOWN; k++)
+				printf("%-12s %s\n", known[k].name,
+				       known[k].path ? known[k].path : "int $0x80 getpid/write");
+			return EXIT_SUCCESS;
+		default:
+			usage(argv[0]);
+		}
+	}
+	cfg.msg_len = strlen(cfg.msg);
+
+	sched_getaffinity(0, sizeof(allowed), &allowed);
+	cpus = calloc(CPU_SETSIZE, sizeof(*cpus));
+	for (i = 0; i < CPU_SETSIZE; i++)
+		if (CPU_ISSET(i, &allowed))
+			cpus[nr_cpus++] = i;
+	if (cfg.max_threads <= 0)
+		cfg.max_threads = nr_cpus;
+
+	low_buf = mmap(NULL, 4096, PROT_READ | PROT_WRITE,
+#ifdef MAP_32BIT
+		       MAP_32BIT |
+#endif
+		       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (low_buf == MAP_FAILED || (uintptr_t)low_buf > 0xffffffffUL)
+		low_buf = NULL;
+	else
+		strncpy(low_buf, cfg.msg, 4095);
+
+	if (names) {
+		char *name = strtok(names, ",");
+
+		for (; name; name = strtok(NULL, ",")) {
+			struct iface *f = find_iface(name);
+
+			if (!f) {
+				fprintf(stderr, "unknown interface %s\n", name);
+				return EXIT_FAILURE;
+			}
+			if (cfg.nr_ifaces < MAX_IFACES)
+				cfg.ifaces[cfg.nr_ifaces++] = f;
+		}
+	} else if (!extra.path) {
+		for (k = 0; k < NR_KNOWN && cfg.nr_ifaces < MAX_IFACES; k++)
+			if (iface_usable(&known[k]))
+				cfg.ifaces[cfg.nr_ifaces++] = &known[k];
+	}
+	if (extra.path && cfg.nr_ifaces < MAX_IFACES)
+		cfg.ifaces[cfg.nr_ifaces++] = &extra;
+	if (!cfg.nr_ifaces) {
+		fprintf(stderr, "no interface available, load the modules first\n");
+		return EXIT_FAILURE;
+	}
+
+	if (cfg.csv)
+		printf("iface,threads,write_pct,ops_per_s,p50_ns,p90_ns,p99_ns,p999_ns,max_ns,errors\n");
+	else
+		printf("%-12s %4s %12s %8s %9s %9s %9s %9s %10s %8s\n",
+		       "iface", "thr", "ops/s", "scale", "p50 ns", "p90 ns",
+		       "p99 ns", "p99.9 ns", "max ns", "errors");
+
+	for (i = 0; i < cfg.nr_ifaces; i++) {
+		struct iface *f = cfg.ifaces[i];
+		double base = 0;
+
+		if (!iface_usable(f)) {
+			fprintf(stderr, "%s: not available, skipped\n", f->name);
+			continue;
+		}
+		for (t = cfg.only_max ? cfg.max_threads : 1; ;
+		     t = t * 2 < cfg.max_threads ? t * 2 : cfg.max_threads) {
+			double rate = run_step(&cfg, f, t, base);
+
+			if (!base)
+				base = rate;
+			if (t == cfg.max_threads)
+				break;
+		}
+	}
+	return EXIT_SUCCESS;
+}
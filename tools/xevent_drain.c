@@ -0,0 +1,321 @@
+/*
+ * Drains the relay channel of a module loaded with xevents=1 (see
+ * include/xevent.h): one thread per CPU buffer moves records from
+ * <dir>/cpuN to <out>/cpuN until SIGINT or -t seconds, with splice() where
+ * the kernel offers it for relay files and read() otherwise. Records stay
+ * in the binary struct xevent layout; -p merges such files by time stamp
+ * and prints them as text.
+ *
+ * Reading is what frees space in a relay buffer, so a drainer that falls
+ * behind shows up as a growing <dir>/dropped, not as a slower module.
+ *
+ * usage: xevent_drain [-d dir] [-o outdir] [-t seconds]
+ *        xevent_drain -p files...
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <xevent.h>
+
+#define DEBUGFS_DIR	"/sys/kernel/debug/xevent_xxx"
+#define CHUNK		(64 * 1024)
+#define POLL_MS		100
+
+static const char *type_names[NR_XEVENT_TYPES] = {
+	[XEVENT_NONE]		= "none",
+	[XEVENT_XXX_SHOW]	= "xxx_show",
+	[XEVENT_XXX_STORE]	= "xxx_store",
+	[XEVENT_XXX_ALLOC]	= "xxx_alloc",
+	[XEVENT_XXX_BUFFER]	= "xxx_buffer",
+	[XEVENT_XXX_PACK]	= "xxx_pack",
+	[XEVENT_RW_READ]	= "example_read",
+	[XEVENT_RW_WRITE]	= "example_write",
+	[XEVENT_TM_JIF]		= "tm_jif_show",
+	[XEVENT_TM_ABSK]	= "tm_absk_show",
+};
+
+struct drain {
+	pthread_t thread;
+	char name[16];
+	int in, out;
+	unsigned long long bytes;
+	int err;
+};
+
+static volatile sig_atomic_t stop;
+
+static void on_stop(int sig)
+{
+	stop = 1;
+}
+
+/* moves what is readable now; returns the bytes moved or -1 */
+static ssize_t drain_once(struct drain *d, int pipefd[2], char *buf)
+{
+	ssize_t total = 0, n, w;
+
+	for (;;) {
+		if (pipefd[0] >= 0) {
+			n = splice(d->in, NULL, pipefd[1], NULL, CHUNK,
+				   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+			if (n < 0 && (errno == EINVAL || errno == ENOSYS)) {
+				/* no splice_read on relay files here */
+				close(pipefd[0]);
+				close(pipefd[1]);
+				pipefd[0] = pipefd[1] = -1;
+				continue;
+			}
+			if (n <= 0)
+				break;
+			for (w = 0; w < n; ) {
+				ssize_t m = splice(pipefd[0], NULL, d->out, NULL,
+						   n - w, SPLICE_F_MOVE);
+
+				if (m <= 0)
+					return -1;
+				w += m;
+			}
+		} else {
+			n = read(d->in, buf, CHUNK);
+			if (n <= 0)
+				break;
+			for (w = 0; w < n; ) {
+				ssize_t m = write(d->out, buf + w, n - w);
+
+				if (m <= 0)
+					return -1;
+				w += m;
+			}
+		}
+		total += n;
+	}
+	if (n < 0 && errno != EAGAIN && errno != EINTR)
+		return -1;
+	return total;
+}
+
+static void *drain_thread(void *arg)
+{
+	struct drain *d = arg;
+	struct pollfd pfd = { .fd = d->in, .events = POLLIN };
+	int pipefd[2] = { -1, -1 };
+	char *buf = malloc(CHUNK);
+	ssize_t n;
+
+	if (!buf || pipe(pipefd)) {
+		d->err = errno;
+		free(buf);
+		return NULL;
+	}
+	do {
+		poll(&pfd, 1, POLL_MS);
+		n = drain_once(d, pipefd, buf);
+		if (n < 0) {
+			d->err = errno;
+			break;
+		}
+		d->bytes += n;
+	} while (!stop);
+	/* what was written since the last wakeup */
+	if (!d->err) {
+		n = drain_once(d, pipefd, buf);
+		if (n > 0)
+			d->bytes += n;
+	}
+	if (pipefd[0] >= 0) {
+		close(pipefd[0]);
+		close(pipefd[1]);
+	}
+	free(buf);
+	return NULL;
+}
+
+static int drain(const char *dir, const char *outdir, unsigned int seconds)
+{
+	struct drain *ds = NULL;
+	struct dirent *de;
+	char path[512];
+	unsigned long long dropped = 0;
+	int i, n = 0, res = 0;
+	FILE *f;
+	DIR *dp;
+
+	dp = opendir(dir);
+	if (!dp) {
+		perror(dir);
+		return -1;
+	}
+	if (mkdir(outdir, 0755) && errno != EEXIST) {
+		perror(outdir);
+		closedir(dp);
+		return -1;
+	}
+	while ((de = readdir(dp))) {
+		unsigned int cpu;
+		struct drain *d;
+
+		if (sscanf(de->d_name, "cpu%u", &cpu) != 1)
+			continue;
+		d = realloc(ds, (n + 1) * sizeof(*ds));
+		if (!d) {
+			perror("realloc");
+			res = -1;
+			break;
+		}
+		ds = d;
+		d = &ds[n];
+		memset(d, 0, sizeof(*d));
+		snprintf(d->name, sizeof(d->name), "cpu%u", cpu);
+		snprintf(path, sizeof(path), "%s/%s", dir, d->name);
+		d->in = open(path, O_RDONLY | O_NONBLOCK);
+		if (d->in < 0) {
+			perror(path);
+			res = -1;
+			break;
+		}
+		snprintf(path, sizeof(path), "%s/%s", outdir, d->name);
+		d->out = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (d->out < 0) {
+			perror(path);
+			close(d->in);
+			res = -1;
+			break;
+		}
+		n++;
+	}
+	closedir(dp);
+	if (!res && !n) {
+		fprintf(stderr, "%s: no cpuN files\n", dir);
+		res = -1;
+	}
+
+	if (!res) {
+		signal(SIGINT, on_stop);
+		signal(SIGTERM, on_stop);
+		signal(SIGALRM, on_stop);
+		if (seconds)
+			alarm(seconds);
+		for (i = 0; i < n; i++)
+			pthread_create(&ds[i].thread, NULL, drain_thread, &ds[i]);
+		for (i = 0; i < n; i++)
+			pthread_join(ds[i].thread, NULL);
+
+		snprintf(path, sizeof(path), "%s/dropped", dir);
+		f = fopen(path, "r");
+		if (f) {
+			if (fscanf(f, "%llu", &dropped) != 1)
+				dropped = 0;
+			fclose(f);
+		}
+		for (i = 0; i < n; i++) {
+			if (ds[i].err) {
+				errno = ds[i].err;
+				fprintf(stderr, "%s: %m\n", ds[i].name);
+				res = -1;
+			}
+			printf("%-8s %12llu events\n", ds[i].name,
+			       ds[i].bytes / sizeof(struct xevent));
+		}
+		printf("%-8s %12llu events\n", "dropped", dropped);
+	}
+	for (i = 0; i < n; i++) {
+		close(ds[i].in);
+		close(ds[i].out);
+	}
+	free(ds);
+	return res;
+}
+
+static int by_time(const void *a, const void *b)
+{
+	const struct xevent *x = a, *y = b;
+
+	return x->ts_ns < y->ts_ns ? -1 : x->ts_ns > y->ts_ns;
+}
+
+static int print(char **files, int nr_files)
+{
+	struct xevent *evs = NULL;
+	size_t n = 0, i;
+	int f;
+
+	for (f = 0; f < nr_files; f++) {
+		FILE *fp = fopen(files[f], "r");
+		struct xevent ev;
+
+		if (!fp) {
+			perror(files[f]);
+			free(evs);
+			return -1;
+		}
+		while (fread(&ev, sizeof(ev), 1, fp) == 1) {
+			if (!(n & (n - 1))) {
+				struct xevent *p = realloc(evs, (n ? 2 * n : 1) *
+							   sizeof(*evs));
+
+				if (!p) {
+					perror("realloc");
+					fclose(fp);
+					free(evs);
+					return -1;
+				}
+				evs = p;
+			}
+			evs[n++] = ev;
+		}
+		fclose(fp);
+	}
+	qsort(evs, n, sizeof(*evs), by_time);
+	for (i = 0; i < n; i++) {
+		const struct xevent *ev = &evs[i];
+		const char *name = ev->type < NR_XEVENT_TYPES ?
+				   type_names[ev->type] : NULL;
+
+		printf("%llu.%09llu cpu%-3u %7u %-14s %#llx %llu\n",
+		       ev->ts_ns / 1000000000, ev->ts_ns % 1000000000, ev->cpu,
+		       ev->pid, name ? name : "?", ev->arg0, ev->arg1);
+	}
+	free(evs);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *dir = DEBUGFS_DIR, *outdir = "xevents";
+	unsigned int seconds = 0;
+	int opt, do_print = 0;
+
+	while ((opt = getopt(argc, argv, "d:o:t:p")) != -1) {
+		switch (opt) {
+		case 'd':
+			dir = optarg;
+			break;
+		case 'o':
+			outdir = optarg;
+			break;
+		case 't':
+			seconds = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			do_print = 1;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-d dir] [-o outdir] [-t seconds]\n"
+				"       %s -p files...\n", argv[0], argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (do_print)
+		return print(argv + optind, argc - optind) ? EXIT_FAILURE :
+							      EXIT_SUCCESS;
+	return drain(dir, outdir, seconds) ? EXIT_FAILURE : EXIT_SUCCESS;
+}